@@ -0,0 +1,295 @@
+#include "ad_analytics.h"
+
+#include <dmsdk/dlib/condition_variable.h>
+#include <dmsdk/dlib/mutex.h>
+#include <dmsdk/dlib/thread.h>
+#include <string.h>
+
+#include "firebase/admob/banner_view.h"
+#include "firebase/analytics/event_names.h"
+#include "firebase/analytics/parameter_names.h"
+#include "alloc.h"
+#include "enums.h"
+#include "firebase_modules.h"
+#include "jni_env.h"
+#include "profile.h"
+
+#if defined(ADMOB_WITH_ANALYTICS)
+#include "firebase/analytics.h"
+#endif
+
+namespace AdMobExtension {
+
+static const uint32_t ANALYTICS_MAX_BATCHES = 4;
+static const uint32_t ANALYTICS_MAX_EVENTS = 32;        // Per batch
+static const uint32_t ANALYTICS_MAX_STRINGS = 2048;     // Bytes per batch
+static const uint32_t ANALYTICS_MAX_PARAMETERS = 4;     // Per event
+
+// There are no standard ad events in this sdk version
+static const char* const ANALYTICS_EVENT_AD_LOADED = "admob_ad_loaded";
+static const char* const ANALYTICS_EVENT_AD_FAILED = "admob_ad_failed";
+static const char* const ANALYTICS_EVENT_AD_SHOW = "admob_ad_show";
+static const char* const ANALYTICS_EVENT_AD_CLICK = "admob_ad_click";
+
+static const char* ANALYTICS_AD_TYPE_NAMES[ADMOB_TYPE_MAX] = { "banner", "interstitial", "rewardedvideo", "nativeexpress" };
+
+enum AnalyticsValueType
+{
+    ANALYTICS_VALUE_INT,
+    ANALYTICS_VALUE_DOUBLE,
+    ANALYTICS_VALUE_STRING,     // Static, or in the strings of the batch
+};
+
+struct AnalyticsParameter
+{
+    const char* m_Name;     // From parameter_names.h
+    const char* m_String;
+    double      m_Double;
+    int64_t     m_Int;
+    uint8_t     m_Type;     // AnalyticsValueType
+};
+
+struct AnalyticsEvent
+{
+    const char*         m_Name;
+    AnalyticsParameter  m_Parameters[ANALYTICS_MAX_PARAMETERS];
+    uint32_t            m_NumParameters;
+};
+
+// The arena of the events recorded during a frame. It is reset when its events were logged
+struct AnalyticsBatch
+{
+    AnalyticsEvent  m_Events[ANALYTICS_MAX_EVENTS];
+    uint32_t        m_NumEvents;
+    uint32_t        m_StringsSize;
+    char            m_Strings[ANALYTICS_MAX_STRINGS];
+};
+
+struct Analytics
+{
+    AnalyticsBatch*                         m_Batches;
+    AnalyticsBatch*                         m_Filling;      // Main thread
+    AnalyticsBatch*                         m_Free[ANALYTICS_MAX_BATCHES];
+    AnalyticsBatch*                         m_Queued[ANALYTICS_MAX_BATCHES];    // In order
+    uint32_t                                m_NumFree;
+    uint32_t                                m_NumQueued;
+    dmMutex::HMutex                         m_Mutex;        // Protects the free and queued batches
+    dmConditionVariable::HConditionVariable m_BatchQueued;
+    dmThread::Thread                        m_Thread;
+    bool                                    m_Started;
+    bool                                    m_Quit;
+};
+
+static Analytics g_Analytics;
+
+#if defined(ADMOB_WITH_ANALYTICS)
+static firebase::analytics::Parameter g_Parameters[ANALYTICS_MAX_PARAMETERS];  // Reused by the thread for each event
+#endif
+
+// Runs on the analytics thread
+static void LogBatch(AnalyticsBatch* batch)
+{
+    for( uint32_t i = 0; i < batch->m_NumEvents; ++i )
+    {
+        const AnalyticsEvent* event = &batch->m_Events[i];
+#if defined(ADMOB_WITH_ANALYTICS)
+        for( uint32_t p = 0; p < event->m_NumParameters; ++p )
+        {
+            const AnalyticsParameter* parameter = &event->m_Parameters[p];
+            g_Parameters[p].name = parameter->m_Name;
+            switch( parameter->m_Type )
+            {
+            case ANALYTICS_VALUE_INT:    g_Parameters[p].value = firebase::Variant::FromInt64(parameter->m_Int); break;
+            case ANALYTICS_VALUE_DOUBLE: g_Parameters[p].value = firebase::Variant::FromDouble(parameter->m_Double); break;
+            default:                     g_Parameters[p].value = firebase::Variant::FromStaticString(parameter->m_String); break;
+            }
+        }
+        firebase::analytics::LogEvent(event->m_Name, g_Parameters, event->m_NumParameters);
+#else
+        (void)event;
+#endif
+    }
+    ProfileAddCount(PROFILE_COUNTER_ANALYTICS_EVENTS, (int)batch->m_NumEvents);
+    batch->m_NumEvents = 0;
+    batch->m_StringsSize = 0;
+}
+
+static void AnalyticsThread(void* arg)
+{
+    (void)arg;
+#if defined(DM_PLATFORM_ANDROID)
+    GetJNIEnv(); // Attach once, the LogEvent calls on this thread reuse the attachment
+#endif
+    while( true )
+    {
+        AnalyticsBatch* batch;
+        {
+            DM_MUTEX_SCOPED_LOCK(g_Analytics.m_Mutex);
+            while( g_Analytics.m_NumQueued == 0 && !g_Analytics.m_Quit )
+            {
+                dmConditionVariable::Wait(g_Analytics.m_BatchQueued, g_Analytics.m_Mutex);
+            }
+            if( g_Analytics.m_NumQueued == 0 )
+                return;
+
+            batch = g_Analytics.m_Queued[0];
+            for( uint32_t i = 1; i < g_Analytics.m_NumQueued; ++i )
+                g_Analytics.m_Queued[i-1] = g_Analytics.m_Queued[i];
+            --g_Analytics.m_NumQueued;
+        }
+
+        LogBatch(batch);
+
+        {
+            DM_MUTEX_SCOPED_LOCK(g_Analytics.m_Mutex);
+            g_Analytics.m_Free[g_Analytics.m_NumFree++] = batch;
+        }
+    }
+}
+
+void AnalyticsInit()
+{
+    memset(&g_Analytics, 0, sizeof(g_Analytics));
+}
+
+void AnalyticsStart()
+{
+    if( g_Analytics.m_Started )
+        return;
+
+    g_Analytics.m_Batches = (AnalyticsBatch*)Malloc(sizeof(AnalyticsBatch) * ANALYTICS_MAX_BATCHES);
+    memset(g_Analytics.m_Batches, 0, sizeof(AnalyticsBatch) * ANALYTICS_MAX_BATCHES);
+    g_Analytics.m_Filling = &g_Analytics.m_Batches[0];
+    for( uint32_t i = 1; i < ANALYTICS_MAX_BATCHES; ++i )
+    {
+        g_Analytics.m_Free[g_Analytics.m_NumFree++] = &g_Analytics.m_Batches[i];
+    }
+
+    g_Analytics.m_Mutex = dmMutex::New();
+    g_Analytics.m_BatchQueued = dmConditionVariable::New();
+    g_Analytics.m_Quit = false;
+    g_Analytics.m_Thread = dmThread::New(AnalyticsThread, 0x10000, 0, "admob_analytics");
+    g_Analytics.m_Started = true;
+}
+
+void AnalyticsFinalize()
+{
+    if( !g_Analytics.m_Started )
+        return;
+
+    AnalyticsUpdate();
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Analytics.m_Mutex);
+        g_Analytics.m_Quit = true;
+        dmConditionVariable::Signal(g_Analytics.m_BatchQueued);
+    }
+    dmThread::Join(g_Analytics.m_Thread); // After the queued batches are logged
+
+    dmConditionVariable::Delete(g_Analytics.m_BatchQueued);
+    dmMutex::Delete(g_Analytics.m_Mutex);
+    Free(g_Analytics.m_Batches);
+    memset(&g_Analytics, 0, sizeof(g_Analytics));
+}
+
+// Copies the string into the batch. Returns 0 if it's full
+static const char* CopyString(AnalyticsBatch* batch, const char* s)
+{
+    uint32_t size = (uint32_t)strlen(s) + 1;
+    if( batch->m_StringsSize + size > ANALYTICS_MAX_STRINGS )
+        return 0;
+    char* copy = &batch->m_Strings[batch->m_StringsSize];
+    memcpy(copy, s, size);
+    batch->m_StringsSize += size;
+    return copy;
+}
+
+static void AddString(AnalyticsEvent* event, const char* name, const char* value)
+{
+    AnalyticsParameter* parameter = &event->m_Parameters[event->m_NumParameters++];
+    parameter->m_Name = name;
+    parameter->m_String = value;
+    parameter->m_Type = ANALYTICS_VALUE_STRING;
+}
+
+static void AddInt(AnalyticsEvent* event, const char* name, int64_t value)
+{
+    AnalyticsParameter* parameter = &event->m_Parameters[event->m_NumParameters++];
+    parameter->m_Name = name;
+    parameter->m_Int = value;
+    parameter->m_Type = ANALYTICS_VALUE_INT;
+}
+
+static void AddDouble(AnalyticsEvent* event, const char* name, double value)
+{
+    AnalyticsParameter* parameter = &event->m_Parameters[event->m_NumParameters++];
+    parameter->m_Name = name;
+    parameter->m_Double = value;
+    parameter->m_Type = ANALYTICS_VALUE_DOUBLE;
+}
+
+void AnalyticsLogAdEvent(int ad_type, int message, const char* ad_unit, int error, float reward, const char* reward_type)
+{
+    if( !g_Analytics.m_Started )
+        return;
+
+    const char* name;
+    switch( message )
+    {
+    case ADMOB_MESSAGE_LOADED:          name = ANALYTICS_EVENT_AD_LOADED; break;
+    case ADMOB_MESSAGE_FAILED_TO_LOAD:  name = ANALYTICS_EVENT_AD_FAILED; break;
+    case ADMOB_MESSAGE_SHOW:            name = ANALYTICS_EVENT_AD_SHOW; break;
+    case ADMOB_MESSAGE_APP_LEAVE:       name = ANALYTICS_EVENT_AD_CLICK; break;
+    case ADMOB_MESSAGE_REWARD:          name = firebase::analytics::kEventEarnVirtualCurrency; break;
+    default:
+        return;
+    }
+
+    // The batch is handed over at the end of the frame, unless the thread is behind
+    AnalyticsBatch* batch = g_Analytics.m_Filling;
+    uint32_t strings_size = batch->m_StringsSize;
+    const char* ad_unit_copy = 0;
+    const char* reward_type_copy = 0;
+    if( batch->m_NumEvents < ANALYTICS_MAX_EVENTS )
+    {
+        ad_unit_copy = CopyString(batch, ad_unit ? ad_unit : "");
+        if( ad_unit_copy && message == ADMOB_MESSAGE_REWARD )
+            reward_type_copy = CopyString(batch, reward_type ? reward_type : "");
+    }
+    if( !ad_unit_copy || (message == ADMOB_MESSAGE_REWARD && !reward_type_copy) )
+    {
+        batch->m_StringsSize = strings_size;
+        ProfileAddCount(PROFILE_COUNTER_DROPPED_ANALYTICS_EVENTS, 1);
+        return;
+    }
+
+    AnalyticsEvent* event = &batch->m_Events[batch->m_NumEvents++];
+    event->m_Name = name;
+    event->m_NumParameters = 0;
+    AddString(event, firebase::analytics::kParameterContentType, ANALYTICS_AD_TYPE_NAMES[ad_type]);
+    AddString(event, firebase::analytics::kParameterItemID, ad_unit_copy);
+    if( message == ADMOB_MESSAGE_FAILED_TO_LOAD )
+    {
+        AddInt(event, firebase::analytics::kParameterValue, error);
+    }
+    else if( message == ADMOB_MESSAGE_REWARD )
+    {
+        AddString(event, firebase::analytics::kParameterVirtualCurrencyName, reward_type_copy);
+        AddDouble(event, firebase::analytics::kParameterValue, reward);
+    }
+}
+
+void AnalyticsUpdate()
+{
+    if( !g_Analytics.m_Started || g_Analytics.m_Filling->m_NumEvents == 0 )
+        return;
+
+    DM_MUTEX_SCOPED_LOCK(g_Analytics.m_Mutex);
+    if( g_Analytics.m_NumFree == 0 )
+        return; // The thread is behind, the events are handed over with the next frame's
+
+    g_Analytics.m_Queued[g_Analytics.m_NumQueued++] = g_Analytics.m_Filling;
+    g_Analytics.m_Filling = g_Analytics.m_Free[--g_Analytics.m_NumFree];
+    dmConditionVariable::Signal(g_Analytics.m_BatchQueued);
+}
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <dmsdk/sdk.h>
+
+namespace AdMobExtension {
+
+// Logs the ad events (loads, failures, shows, clicks and rewards) to Firebase Analytics, without going through Lua.
+// The events of a frame are recorded into a preallocated batch (the strings are copied into it), which is handed over
+// to a background thread at the end of the frame. That thread builds the Parameter arrays and calls analytics::LogEvent(),
+// so the main thread neither allocates nor calls the sdk (JNI on Android) for them.
+
+void AnalyticsInit();
+void AnalyticsFinalize();   // Logs the remaining events. Before the analytics module is terminated
+
+// Allocates the batches and starts the thread, once the analytics module is ready
+void AnalyticsStart();
+
+// Records an AdMobEvent of an ad. The other messages are ignored. Main thread
+void AnalyticsLogAdEvent(int ad_type, int message, const char* ad_unit, int error, float reward, const char* reward_type);
+
+// Hands the events of the frame over to the thread. Main thread
+void AnalyticsUpdate();
+
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <dmsdk/sdk.h>
+
+#include "firebase/admob/banner_view.h"
+#include "firebase/admob/interstitial_ad.h"
+#include "firebase/admob/native_express_ad_view.h"
+#include "firebase/admob/rewarded_video.h"
+#include "alloc.h"
+#include "enums.h"
+#include "listeners.h"
+
+namespace AdMobExtension {
+
+// The compile time description of each ad format: its ad type, its listener, and the sdk calls that differ between the formats.
+// The format code in googlemobileads.cpp is instantiated per format, and dispatched through a table indexed by the ad type.
+template<typename T> struct AdFormatTraits;
+
+// The rewarded video ad isn't an object, but the functions of the firebase::admob::rewarded_video namespace
+struct RewardedVideoFormat {};
+
+// The positions are passed as is to both view classes
+static_assert((int)firebase::admob::BannerView::kPositionTop == ADMOB_POSITION_TOP, "Position mismatch");
+static_assert((int)firebase::admob::BannerView::kPositionBottom == ADMOB_POSITION_BOTTOM, "Position mismatch");
+static_assert((int)firebase::admob::BannerView::kPositionTopLeft == ADMOB_POSITION_TOPLEFT, "Position mismatch");
+static_assert((int)firebase::admob::BannerView::kPositionTopRight == ADMOB_POSITION_TOPRIGHT, "Position mismatch");
+static_assert((int)firebase::admob::BannerView::kPositionBottomLeft == ADMOB_POSITION_BOTTOMLEFT, "Position mismatch");
+static_assert((int)firebase::admob::BannerView::kPositionBottomRight == ADMOB_POSITION_BOTTOMRIGHT, "Position mismatch");
+static_assert((int)firebase::admob::NativeExpressAdView::kPositionTop == ADMOB_POSITION_TOP, "Position mismatch");
+static_assert((int)firebase::admob::NativeExpressAdView::kPositionBottom == ADMOB_POSITION_BOTTOM, "Position mismatch");
+static_assert((int)firebase::admob::NativeExpressAdView::kPositionTopLeft == ADMOB_POSITION_TOPLEFT, "Position mismatch");
+static_assert((int)firebase::admob::NativeExpressAdView::kPositionTopRight == ADMOB_POSITION_TOPRIGHT, "Position mismatch");
+static_assert((int)firebase::admob::NativeExpressAdView::kPositionBottomLeft == ADMOB_POSITION_BOTTOMLEFT, "Position mismatch");
+static_assert((int)firebase::admob::NativeExpressAdView::kPositionBottomRight == ADMOB_POSITION_BOTTOMRIGHT, "Position mismatch");
+
+template<> struct AdFormatTraits<firebase::admob::BannerView>
+{
+    typedef firebase::admob::BannerView T;
+    typedef BannerViewListener Listener;
+    static const AdMobAdType TYPE = ADMOB_TYPE_BANNER;
+    static const char* Name() { return "banner"; } // As in the Lua functions and game.project keys
+    static const bool IS_VIEW = true;
+
+    static T* New() { CountAllocation(); return new T; }
+    static void InitializeFormat() {}
+    static void FinalizeFormat() {}
+    static firebase::Future<void> Initialize(T* ad, firebase::admob::AdParent parent, const char* ad_unit, const firebase::admob::AdSize& size)
+    {
+        ad->Initialize(parent, ad_unit, size);
+        return ad->InitializeLastResult();
+    }
+    static firebase::Future<void> LoadAd(T* ad, const char* ad_unit, const firebase::admob::AdRequest& request)
+    {
+        (void)ad_unit;
+        ad->LoadAd(request);
+        return ad->LoadAdLastResult();
+    }
+    static Listener* NewListener(int32_atomic_t* coveringad, BoundingBoxCache* bounds, int id)
+    {
+        CountAllocation();
+        return new Listener(coveringad, bounds, id);
+    }
+    static void SetListener(T* ad, Listener* listener) { ad->SetListener(listener); }
+    static firebase::admob::BoundingBox GetBoundingBox(T* ad) { return ad->bounding_box(); }
+};
+
+template<> struct AdFormatTraits<firebase::admob::NativeExpressAdView>
+{
+    typedef firebase::admob::NativeExpressAdView T;
+    typedef NativeExpressAdViewListener Listener;
+    static const AdMobAdType TYPE = ADMOB_TYPE_NATIVEEXPRESS;
+    static const char* Name() { return "nativeexpress"; } // As in the Lua functions and game.project keys
+    static const bool IS_VIEW = true;
+
+    static T* New() { CountAllocation(); return new T; }
+    static void InitializeFormat() {}
+    static void FinalizeFormat() {}
+    static firebase::Future<void> Initialize(T* ad, firebase::admob::AdParent parent, const char* ad_unit, const firebase::admob::AdSize& size)
+    {
+        ad->Initialize(parent, ad_unit, size);
+        return ad->InitializeLastResult();
+    }
+    static firebase::Future<void> LoadAd(T* ad, const char* ad_unit, const firebase::admob::AdRequest& request)
+    {
+        (void)ad_unit;
+        ad->LoadAd(request);
+        return ad->LoadAdLastResult();
+    }
+    static Listener* NewListener(int32_atomic_t* coveringad, BoundingBoxCache* bounds, int id)
+    {
+        CountAllocation();
+        return new Listener(coveringad, bounds, id);
+    }
+    static void SetListener(T* ad, Listener* listener) { ad->SetListener(listener); }
+    static firebase::admob::BoundingBox GetBoundingBox(T* ad) { return ad->GetBoundingBox(); }
+};
+
+template<> struct AdFormatTraits<firebase::admob::InterstitialAd>
+{
+    typedef firebase::admob::InterstitialAd T;
+    typedef InterstitialAdListener Listener;
+    static const AdMobAdType TYPE = ADMOB_TYPE_INTERSTITIAL;
+    static const char* Name() { return "interstitial"; } // As in the Lua functions and game.project keys
+    static const bool IS_VIEW = false;
+
+    static T* New() { CountAllocation(); return new T; }
+    static void InitializeFormat() {}
+    static void FinalizeFormat() {}
+    static firebase::Future<void> Initialize(T* ad, firebase::admob::AdParent parent, const char* ad_unit, const firebase::admob::AdSize& size)
+    {
+        (void)size;
+        ad->Initialize(parent, ad_unit);
+        return ad->InitializeLastResult();
+    }
+    static firebase::Future<void> LoadAd(T* ad, const char* ad_unit, const firebase::admob::AdRequest& request)
+    {
+        (void)ad_unit;
+        ad->LoadAd(request);
+        return ad->LoadAdLastResult();
+    }
+    static Listener* NewListener(int32_atomic_t* coveringad, BoundingBoxCache* bounds, int id)
+    {
+        (void)bounds;
+        CountAllocation();
+        return new Listener(coveringad, id);
+    }
+    static void SetListener(T* ad, Listener* listener) { ad->SetListener(listener); }
+};
+
+template<> struct AdFormatTraits<RewardedVideoFormat>
+{
+    typedef RewardedVideoFormat T;
+    typedef RewardedVideoListener Listener;
+    static const AdMobAdType TYPE = ADMOB_TYPE_REWARDEDVIDEO;
+    static const char* Name() { return "rewardedvideo"; } // As in the Lua functions and game.project keys
+    static const bool IS_VIEW = false;
+
+    static T* New() { return 0; }
+    // The loads chain behind its InitializeLastResult()
+    static void InitializeFormat() { firebase::admob::rewarded_video::Initialize(); }
+    static void FinalizeFormat() { firebase::admob::rewarded_video::Destroy(); }
+    static firebase::Future<void> Initialize(T* ad, firebase::admob::AdParent parent, const char* ad_unit, const firebase::admob::AdSize& size)
+    {
+        (void)ad; (void)parent; (void)ad_unit; (void)size;
+        return firebase::admob::rewarded_video::InitializeLastResult();
+    }
+    static firebase::Future<void> LoadAd(T* ad, const char* ad_unit, const firebase::admob::AdRequest& request)
+    {
+        (void)ad;
+        firebase::admob::rewarded_video::LoadAd(ad_unit, request);
+        return firebase::admob::rewarded_video::LoadAdLastResult();
+    }
+    static Listener* NewListener(int32_atomic_t* coveringad, BoundingBoxCache* bounds, int id)
+    {
+        (void)bounds;
+        CountAllocation();
+        return new Listener(coveringad, id);
+    }
+    static void SetListener(T* ad, Listener* listener) { (void)ad; firebase::admob::rewarded_video::SetListener(listener); }
+};
+
+}
@@ -0,0 +1,45 @@
+#include "alloc.h"
+
+#include <dmsdk/dlib/atomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace AdMobExtension {
+
+static int32_atomic_t   g_AllocationCount = 0;
+static __thread int     g_ThreadAllocationCount = 0;
+
+void CountAllocation()
+{
+    dmAtomicIncrement32(&g_AllocationCount);
+    g_ThreadAllocationCount++;
+}
+
+void* Malloc(size_t size)
+{
+    CountAllocation();
+    return malloc(size);
+}
+
+char* StrDup(const char* s)
+{
+    CountAllocation();
+    return strdup(s);
+}
+
+void Free(void* ptr)
+{
+    free(ptr);
+}
+
+int GetAllocationCount()
+{
+    return dmAtomicGet32(&g_AllocationCount);
+}
+
+int GetThreadAllocationCount()
+{
+    return g_ThreadAllocationCount;
+}
+
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace AdMobExtension {
+
+// Counting wrappers for the allocations made by the extension itself (not by the Firebase sdk)
+
+void* Malloc(size_t size);
+char* StrDup(const char* s);
+void  Free(void* ptr);
+
+// Call for each object allocated with 'new'
+void  CountAllocation();
+
+int   GetAllocationCount();         // All threads
+int   GetThreadAllocationCount();   // The calling thread only
+
+}
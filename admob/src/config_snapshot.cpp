@@ -0,0 +1,173 @@
+#include "config_snapshot.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "firebase_modules.h"
+#include "profile.h"
+
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+#include <string>
+#include <vector>
+#include "firebase/remote_config.h"
+#endif
+
+namespace AdMobExtension {
+
+static const uint32_t CONFIG_MAX_SNAPSHOTS = 16;
+
+struct ConfigSnapshot
+{
+    dmhash_t    m_PrefixHash;
+    lua_State*  m_L;            // The main thread of the Lua context (the registry it's referenced in)
+    int         m_Ref;          // LUA_NOREF if the slot is free
+    uint32_t    m_Version;
+};
+
+struct ConfigSnapshots
+{
+    ConfigSnapshot  m_Snapshots[CONFIG_MAX_SNAPSHOTS];
+    uint32_t        m_NextEvicted;  // When all slots are used, they are reused in turn
+};
+
+static ConfigSnapshots g_ConfigSnapshots;
+
+static void ReleaseSnapshot(ConfigSnapshot* snapshot)
+{
+    if( snapshot->m_Ref != LUA_NOREF )
+        dmScript::Unref(snapshot->m_L, LUA_REGISTRYINDEX, snapshot->m_Ref);
+    snapshot->m_Ref = LUA_NOREF;
+}
+
+void ConfigSnapshotInit()
+{
+    memset(&g_ConfigSnapshots, 0, sizeof(g_ConfigSnapshots));
+    for( uint32_t i = 0; i < CONFIG_MAX_SNAPSHOTS; ++i )
+    {
+        g_ConfigSnapshots.m_Snapshots[i].m_Ref = LUA_NOREF;
+    }
+}
+
+void ConfigSnapshotFinalize()
+{
+    for( uint32_t i = 0; i < CONFIG_MAX_SNAPSHOTS; ++i )
+    {
+        ReleaseSnapshot(&g_ConfigSnapshots.m_Snapshots[i]);
+    }
+}
+
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+// Only plain decimal numbers: [+-]digits[.digits][(e|E)[+-]digits]. strtod also accepts "inf", "nan" and hex numbers,
+// which would turn such strings into numbers
+static bool IsDecimal(const char* value)
+{
+    const char* p = value;
+    if( *p == '+' || *p == '-' )
+        ++p;
+    const char* digits = p;
+    while( *p >= '0' && *p <= '9' )
+        ++p;
+    if( *p == '.' )
+    {
+        ++p;
+        while( *p >= '0' && *p <= '9' )
+            ++p;
+    }
+    if( p == digits || (p == digits + 1 && *digits == '.') )
+        return false;
+    if( *p == 'e' || *p == 'E' )
+    {
+        ++p;
+        if( *p == '+' || *p == '-' )
+            ++p;
+        if( *p < '0' || *p > '9' )
+            return false;
+        while( *p >= '0' && *p <= '9' )
+            ++p;
+    }
+    return *p == 0;
+}
+
+// The values are all strings in Remote Config, so they are converted here, instead of trying each typed getter (a JNI call each)
+static void PushValue(lua_State* L, const char* value)
+{
+    if( strcmp(value, "true") == 0 || strcmp(value, "false") == 0 )
+    {
+        lua_pushboolean(L, value[0] == 't');
+        return;
+    }
+
+    if( IsDecimal(value) )
+        lua_pushnumber(L, strtod(value, 0));
+    else
+        lua_pushstring(L, value);
+}
+#endif
+
+static void PushNewTable(lua_State* L, const char* prefix)
+{
+    ProfileAddCount(PROFILE_COUNTER_CONFIG_SNAPSHOTS, 1);
+
+    lua_newtable(L);
+
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+    std::vector<std::string> keys = firebase::remote_config::GetKeysByPrefix(prefix);
+    for( size_t i = 0; i < keys.size(); ++i )
+    {
+        std::string value = firebase::remote_config::GetString(keys[i].c_str());
+        PushValue(L, value.c_str());
+        lua_setfield(L, -2, keys[i].c_str());
+    }
+#else
+    (void)prefix;
+#endif
+}
+
+void ConfigSnapshotPush(lua_State* L, const char* prefix, uint32_t version)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    // The function may be called from a coroutine, but the table is referenced in the registry shared by its main thread
+    lua_State* main_thread = dmScript::GetMainThread(L);
+    dmhash_t hash = dmHashString64(prefix);
+    ConfigSnapshot* found = 0;
+    ConfigSnapshot* free_slot = 0;
+    for( uint32_t i = 0; i < CONFIG_MAX_SNAPSHOTS; ++i )
+    {
+        ConfigSnapshot* s = &g_ConfigSnapshots.m_Snapshots[i];
+        if( s->m_Ref == LUA_NOREF )
+        {
+            if( !free_slot )
+                free_slot = s;
+        }
+        else if( s->m_PrefixHash == hash && s->m_L == main_thread )
+        {
+            found = s;
+            break;
+        }
+    }
+
+    if( found && found->m_Version == version )
+    {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, found->m_Ref);
+        return;
+    }
+
+    ConfigSnapshot* snapshot = found ? found : free_slot;
+    if( !snapshot )
+    {
+        snapshot = &g_ConfigSnapshots.m_Snapshots[g_ConfigSnapshots.m_NextEvicted];
+        g_ConfigSnapshots.m_NextEvicted = (g_ConfigSnapshots.m_NextEvicted + 1) % CONFIG_MAX_SNAPSHOTS;
+    }
+    ReleaseSnapshot(snapshot);
+
+    PushNewTable(L, prefix);
+
+    lua_pushvalue(L, -1);
+    snapshot->m_Ref = dmScript::Ref(L, LUA_REGISTRYINDEX);
+    snapshot->m_L = main_thread;
+    snapshot->m_PrefixHash = hash;
+    snapshot->m_Version = version;
+}
+
+}
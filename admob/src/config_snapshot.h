@@ -0,0 +1,19 @@
+#pragma once
+
+#include <dmsdk/sdk.h>
+
+namespace AdMobExtension {
+
+// Lua tables with the Remote Config values of a key prefix. The keys are read in one pass, and the table is
+// cached until the values are activated again, so that the game reads its tuning values from Lua, and not through JNI.
+
+void ConfigSnapshotInit();
+
+// Releases the cached tables
+void ConfigSnapshotFinalize();
+
+// Pushes the (shared) table of the prefix: { [key] = value }, where a value is a boolean ("true"/"false"), a number (plain decimals only) or a string.
+// 'version' identifies the activated values, the cached table is rebuilt when it changes.
+void ConfigSnapshotPush(lua_State* L, const char* prefix, uint32_t version);
+
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "firebase/admob/banner_view.h" // The enums below are mapped to the Firebase values
+
 namespace AdMobExtension {
 
 enum AdMobAdType
@@ -22,6 +24,8 @@ enum AdMobError
     ADMOB_ERROR_NETWORKERROR        = firebase::admob::kAdMobErrorNetworkError,
     ADMOB_ERROR_NOFILL              = firebase::admob::kAdMobErrorNoFill,
     ADMOB_ERROR_NOWINDOWTOKEN       = firebase::admob::kAdMobErrorNoWindowToken,
+    ADMOB_ERROR_TIMEOUT,            // Not a Firebase error: the extension gave up on the load (see CheckTimeouts)
+    ADMOB_ERROR_MAX,
 };
 
 // https://firebase.google.com/docs/reference/cpp/namespace/firebase/admob#namespacefirebase_1_1admob_1a1908085a11fb74e08dd24b1ec5b019ec
@@ -58,6 +62,8 @@ enum AdMobEvent
     ADMOB_MESSAGE_REWARD,
     ADMOB_MESSAGE_APP_LEAVE,
     ADMOB_MESSAGE_UNLOADED,
+    ADMOB_MESSAGE_READY,            // The sdk is initialized (sent to the admob.set_ready_callback() callback)
+    ADMOB_MESSAGE_LAYOUT,           // The bounding box of a banner type changed (see admob.get_bounds())
 };
 
 }
\ No newline at end of file
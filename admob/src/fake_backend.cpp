@@ -0,0 +1,1031 @@
+#if defined(ADMOB_FAKE_BACKEND)
+
+#include "fake_backend.h"
+
+#include <dmsdk/dlib/atomic.h>
+#include <dmsdk/dlib/condition_variable.h>
+#include <dmsdk/dlib/mutex.h>
+#include <dmsdk/dlib/thread.h>
+#include <dmsdk/dlib/time.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "firebase/admob.h"
+#include "firebase/admob/banner_view.h"
+#include "firebase/admob/interstitial_ad.h"
+#include "firebase/admob/native_express_ad_view.h"
+#include "firebase/admob/rewarded_video.h"
+#include "firebase/util.h"
+#include "firebase/app.h"
+#include "firebase/future.h"
+
+namespace firebase {
+void* g_admob_initializer = 0;
+}
+
+namespace AdMobExtension {
+
+////////////////////////////////////////////////////////////////////////////////////////
+// Futures
+
+static const uint32_t FAKE_MAX_FUTURES = 4096;
+
+struct FakeFuture
+{
+    firebase::FutureBase::CompletionCallback    m_Callback;
+    void*                                       m_UserData;
+    const char*                                 m_Message;  // Always a static string
+    int32_t                                     m_RefCount;
+    int                                         m_Error;
+    firebase::FutureStatus                      m_Status;
+    uint16_t                                    m_Generation;
+    uint8_t                                     m_InUse;
+};
+
+class FakeFutureApi : public firebase::detail::FutureApiInterface
+{
+public:
+    FakeFutureApi() : m_Mutex(0), m_Next(0) {}
+
+    void Init()
+    {
+        m_Mutex = dmMutex::New();
+        memset(m_Futures, 0, sizeof(m_Futures));
+        m_Next = 0;
+    }
+
+    void Finalize()
+    {
+        dmMutex::Delete(m_Mutex);
+        m_Mutex = 0;
+    }
+
+    // Returns the handle of a new, pending future, without any references. Returns 0 if the pool is exhausted.
+    firebase::FutureHandle Alloc()
+    {
+        DM_MUTEX_SCOPED_LOCK(m_Mutex);
+        for( uint32_t i = 0; i < FAKE_MAX_FUTURES; ++i)
+        {
+            uint32_t index = (m_Next + i) % FAKE_MAX_FUTURES;
+            FakeFuture* f = &m_Futures[index];
+            if( f->m_InUse )
+                continue;
+            uint16_t generation = f->m_Generation + 1;
+            memset(f, 0, sizeof(*f));
+            f->m_Generation = generation;
+            f->m_InUse = 1;
+            f->m_Status = firebase::kFutureStatusPending;
+            m_Next = index + 1;
+            return MakeHandle(index, generation);
+        }
+        dmLogError("The fake backend ran out of futures (max %u)", FAKE_MAX_FUTURES);
+        return 0;
+    }
+
+    void Complete(firebase::FutureHandle handle, int error, const char* message)
+    {
+        firebase::FutureBase::CompletionCallback callback = 0;
+        void* user_data = 0;
+        {
+            DM_MUTEX_SCOPED_LOCK(m_Mutex);
+            FakeFuture* f = Get(handle);
+            if( !f || f->m_Status != firebase::kFutureStatusPending )
+                return;
+            f->m_Status = firebase::kFutureStatusComplete;
+            f->m_Error = error;
+            f->m_Message = message;
+            callback = f->m_Callback;
+            user_data = f->m_UserData;
+        }
+        if( callback )
+        {
+            firebase::Future<void> future(this, handle);
+            callback(future, user_data);
+        }
+    }
+
+    virtual void ReferenceFuture(firebase::FutureHandle handle)
+    {
+        DM_MUTEX_SCOPED_LOCK(m_Mutex);
+        FakeFuture* f = Get(handle);
+        if( f )
+            f->m_RefCount++;
+    }
+
+    virtual void ReleaseFuture(firebase::FutureHandle handle)
+    {
+        DM_MUTEX_SCOPED_LOCK(m_Mutex);
+        FakeFuture* f = Get(handle);
+        if( f && --f->m_RefCount <= 0 )
+            f->m_InUse = 0;
+    }
+
+    virtual firebase::FutureStatus GetFutureStatus(firebase::FutureHandle handle) const
+    {
+        DM_MUTEX_SCOPED_LOCK(m_Mutex);
+        const FakeFuture* f = Get(handle);
+        return f ? f->m_Status : firebase::kFutureStatusInvalid;
+    }
+
+    virtual int GetFutureError(firebase::FutureHandle handle) const
+    {
+        DM_MUTEX_SCOPED_LOCK(m_Mutex);
+        const FakeFuture* f = Get(handle);
+        return f ? f->m_Error : 0;
+    }
+
+    virtual const char* GetFutureErrorMessage(firebase::FutureHandle handle) const
+    {
+        DM_MUTEX_SCOPED_LOCK(m_Mutex);
+        const FakeFuture* f = Get(handle);
+        return f && f->m_Message ? f->m_Message : "";
+    }
+
+    virtual const void* GetFutureResult(firebase::FutureHandle /*handle*/) const
+    {
+        return 0; // All fake futures are Future<void>
+    }
+
+    // Only one callback per future. If the future is already complete, it's called immediately
+    virtual void SetCompletionCallback(firebase::FutureHandle handle, firebase::FutureBase::CompletionCallback callback, void* user_data)
+    {
+        bool complete = false;
+        {
+            DM_MUTEX_SCOPED_LOCK(m_Mutex);
+            FakeFuture* f = Get(handle);
+            if( !f )
+                return;
+            f->m_Callback = callback;
+            f->m_UserData = user_data;
+            complete = f->m_Status == firebase::kFutureStatusComplete;
+        }
+        if( complete && callback )
+        {
+            firebase::Future<void> future(this, handle);
+            callback(future, user_data);
+        }
+    }
+
+private:
+    static firebase::FutureHandle MakeHandle(uint32_t index, uint16_t generation)
+    {
+        return (firebase::FutureHandle)(((uint32_t)generation << 16) | (index + 1));
+    }
+
+    FakeFuture* Get(firebase::FutureHandle handle) const
+    {
+        uint32_t index = (uint32_t)(handle & 0xFFFF) - 1;
+        uint16_t generation = (uint16_t)(handle >> 16);
+        if( index >= FAKE_MAX_FUTURES )
+            return 0;
+        FakeFuture* f = (FakeFuture*)&m_Futures[index];
+        if( !f->m_InUse || f->m_Generation != generation )
+            return 0;
+        return f;
+    }
+
+    dmMutex::HMutex m_Mutex;
+    FakeFuture      m_Futures[FAKE_MAX_FUTURES];
+    uint32_t        m_Next;
+};
+
+static FakeFutureApi g_FutureApi;
+
+////////////////////////////////////////////////////////////////////////////////////////
+// Ads
+
+enum FakeAdKind
+{
+    FAKE_AD_BANNER,
+    FAKE_AD_INTERSTITIAL,
+    FAKE_AD_NATIVEEXPRESS,
+    FAKE_AD_REWARDEDVIDEO,
+};
+
+enum FakeAdFn
+{
+    FAKE_FN_INITIALIZE,
+    FAKE_FN_LOADAD,
+    FAKE_FN_SHOW,
+    FAKE_FN_HIDE,
+    FAKE_FN_PAUSE,
+    FAKE_FN_RESUME,
+    FAKE_FN_DESTROY,
+    FAKE_FN_MOVETO,
+    FAKE_FN_MAX,
+};
+
+enum FakeAdState
+{
+    FAKE_STATE_INITIALIZED  = 1,
+    FAKE_STATE_LOADED       = 2,
+};
+
+struct FakeAd
+{
+    FakeAd(FakeAdKind kind, void* owner) : m_Owner(owner), m_Listener(0), m_Kind(kind), m_State(0), m_Presentation(0), m_InFlight(0)
+    {
+        memset(&m_Size, 0, sizeof(m_Size));
+    }
+
+    firebase::Future<void>          m_Last[FAKE_FN_MAX];    // Protected by the backend mutex
+    firebase::admob::BoundingBox    m_Box;
+    firebase::admob::AdSize         m_Size;
+    void*                           m_Owner;                // The public object (e.g. BannerView*), 0 for rewarded video
+    void*                           m_Listener;
+    FakeAdKind                      m_Kind;
+    uint32_t                        m_State;                // FakeAdState bits
+    int                             m_Presentation;
+    int32_atomic_t                  m_InFlight;             // Number of tasks currently running on the callback threads
+};
+
+enum FakeTaskFlags
+{
+    FAKE_TASK_BOX       = 1,    // Notify the listener about the bounding box
+    FAKE_TASK_REWARD    = 2,    // Give the user a reward
+};
+
+struct FakeTask
+{
+    uint64_t                m_Time;             // When to run the task
+    FakeAd*                 m_Ad;
+    firebase::FutureHandle  m_Future;           // The future to complete (holding a reference), or 0
+    const char*             m_Message;
+    int                     m_Error;
+    int                     m_Presentation;     // The new presentation state, or -1
+    uint32_t                m_SetState;         // FakeAdState bits to set
+    uint32_t                m_ClearState;       // FakeAdState bits to clear
+    uint32_t                m_Flags;            // FakeTaskFlags
+};
+
+static const uint32_t FAKE_MAX_THREADS = 16;
+
+struct FakeBackend
+{
+    FakeBackendParams                           m_Params;
+    dmArray<FakeTask>                           m_Tasks;
+    dmThread::Thread                            m_Threads[FAKE_MAX_THREADS];
+    uint32_t                                    m_NumThreads;
+    dmMutex::HMutex                             m_Mutex;
+    dmConditionVariable::HConditionVariable     m_Cond;
+    uint32_t                                    m_Random;
+    bool                                        m_Running;
+    bool                                        m_HasParams;
+};
+
+static FakeBackend  g_Fake;
+static FakeAd*      g_RewardedVideo = 0;
+static __thread int g_IsCallbackThread = 0;
+
+static const char* GetErrorMessage(int error)
+{
+    switch(error)
+    {
+    case firebase::admob::kAdMobErrorNone:                  return "";
+    case firebase::admob::kAdMobErrorUninitialized:         return "Uninitialized";
+    case firebase::admob::kAdMobErrorAlreadyInitialized:    return "Already initialized";
+    case firebase::admob::kAdMobErrorLoadInProgress:        return "Load in progress";
+    case firebase::admob::kAdMobErrorInternalError:         return "Internal error";
+    case firebase::admob::kAdMobErrorInvalidRequest:        return "Invalid request";
+    case firebase::admob::kAdMobErrorNetworkError:          return "Network error";
+    case firebase::admob::kAdMobErrorNoFill:                return "No fill";
+    case firebase::admob::kAdMobErrorNoWindowToken:         return "No window token";
+    default:                                                return "Unknown error";
+    }
+}
+
+// Returns a number in [0, 1). The mutex must be held
+static float RandomFloat()
+{
+    // xorshift32
+    uint32_t x = g_Fake.m_Random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    g_Fake.m_Random = x;
+    return (x >> 8) / (float)(1 << 24);
+}
+
+// Returns the latency in microseconds. The mutex must be held
+static uint64_t RandomLatency()
+{
+    const FakeBackendParams& p = g_Fake.m_Params;
+    uint32_t ms = p.m_LatencyMin;
+    if( p.m_LatencyMax > p.m_LatencyMin )
+        ms += (uint32_t)(RandomFloat() * (p.m_LatencyMax - p.m_LatencyMin));
+    if( RandomFloat() < p.m_LatencyTailRate )
+        ms += p.m_LatencyTail;
+    return (uint64_t)ms * 1000;
+}
+
+// The mutex must be held
+static void PushTask(const FakeTask& task)
+{
+    if( g_Fake.m_Tasks.Full() )
+        g_Fake.m_Tasks.OffsetCapacity(32);
+    g_Fake.m_Tasks.Push(task);
+    dmConditionVariable::Signal(g_Fake.m_Cond);
+}
+
+static void InitTask(FakeTask* task, FakeAd* ad, uint64_t delay)
+{
+    memset(task, 0, sizeof(*task));
+    task->m_Time = dmTime::GetTime() + delay;
+    task->m_Ad = ad;
+    task->m_Presentation = -1;
+}
+
+// Starts an operation, and schedules the completion of its future.
+// On success, the presentation state (if not -1) and the state bits are applied before the future completes.
+// The outcome of the operation is returned in out_error (if not 0). A stuck operation reports -1.
+static firebase::Future<void> StartOperation(FakeAd* ad, FakeAdFn fn, int error, int presentation, uint32_t set_state, uint32_t clear_state, uint32_t flags, int* out_error)
+{
+    firebase::FutureHandle handle = g_FutureApi.Alloc();
+    firebase::Future<void> future;
+    if( handle )
+        future = firebase::Future<void>(&g_FutureApi, handle);
+
+    DM_MUTEX_SCOPED_LOCK(g_Fake.m_Mutex);
+    ad->m_Last[fn] = future;
+
+    if( error == firebase::admob::kAdMobErrorNone && fn != FAKE_FN_PAUSE && fn != FAKE_FN_RESUME )
+    {
+        if( RandomFloat() < g_Fake.m_Params.m_StuckRate )
+        {
+            if( out_error )
+                *out_error = -1;
+            return future; // Never completes
+        }
+
+        if( RandomFloat() < g_Fake.m_Params.m_ErrorRate )
+            error = g_Fake.m_Params.m_ErrorCode;
+        else if( fn == FAKE_FN_LOADAD && RandomFloat() >= g_Fake.m_Params.m_FillRate )
+            error = firebase::admob::kAdMobErrorNoFill;
+    }
+    if( out_error )
+        *out_error = error;
+
+    FakeTask task;
+    InitTask(&task, ad, RandomLatency());
+    task.m_Error = error;
+    task.m_Message = GetErrorMessage(error);
+    if( error == firebase::admob::kAdMobErrorNone )
+    {
+        task.m_Presentation = presentation;
+        task.m_SetState = set_state;
+        task.m_ClearState = clear_state;
+        task.m_Flags = flags;
+    }
+    if( handle )
+    {
+        g_FutureApi.ReferenceFuture(handle); // Released when the task has run
+        task.m_Future = handle;
+    }
+    PushTask(task);
+    return future;
+}
+
+// Schedules a listener notification, without a future
+static void ScheduleEvent(FakeAd* ad, uint64_t delay, int presentation, uint32_t clear_state, uint32_t flags)
+{
+    DM_MUTEX_SCOPED_LOCK(g_Fake.m_Mutex);
+    FakeTask task;
+    InitTask(&task, ad, delay);
+    task.m_Presentation = presentation;
+    task.m_ClearState = clear_state;
+    task.m_Flags = flags;
+    PushTask(task);
+}
+
+static void DispatchPresentationState(FakeAd* ad, void* listener, int state)
+{
+    switch(ad->m_Kind)
+    {
+    case FAKE_AD_BANNER:
+        ((firebase::admob::BannerView::Listener*)listener)->OnPresentationStateChanged((firebase::admob::BannerView*)ad->m_Owner,
+                                                                                        (firebase::admob::BannerView::PresentationState)state);
+        break;
+    case FAKE_AD_NATIVEEXPRESS:
+        ((firebase::admob::NativeExpressAdView::Listener*)listener)->OnPresentationStateChanged((firebase::admob::NativeExpressAdView*)ad->m_Owner,
+                                                                                                (firebase::admob::NativeExpressAdView::PresentationState)state);
+        break;
+    case FAKE_AD_INTERSTITIAL:
+        ((firebase::admob::InterstitialAd::Listener*)listener)->OnPresentationStateChanged((firebase::admob::InterstitialAd*)ad->m_Owner,
+                                                                                            (firebase::admob::InterstitialAd::PresentationState)state);
+        break;
+    case FAKE_AD_REWARDEDVIDEO:
+        ((firebase::admob::rewarded_video::Listener*)listener)->OnPresentationStateChanged((firebase::admob::rewarded_video::PresentationState)state);
+        break;
+    }
+}
+
+static void DispatchBoundingBox(FakeAd* ad, void* listener, const firebase::admob::BoundingBox& box)
+{
+    if( ad->m_Kind == FAKE_AD_BANNER )
+        ((firebase::admob::BannerView::Listener*)listener)->OnBoundingBoxChanged((firebase::admob::BannerView*)ad->m_Owner, box);
+    else if( ad->m_Kind == FAKE_AD_NATIVEEXPRESS )
+        ((firebase::admob::NativeExpressAdView::Listener*)listener)->OnBoundingBoxChanged((firebase::admob::NativeExpressAdView*)ad->m_Owner, box);
+}
+
+static void RunTask(const FakeTask& task)
+{
+    FakeAd* ad = task.m_Ad;
+    void* listener;
+    firebase::admob::BoundingBox box;
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Fake.m_Mutex);
+        ad->m_State = (ad->m_State | task.m_SetState) & ~task.m_ClearState;
+        if( task.m_Presentation >= 0 )
+            ad->m_Presentation = task.m_Presentation;
+        listener = ad->m_Listener;
+        box = ad->m_Box;
+    }
+
+    if( listener )
+    {
+        if( task.m_Flags & FAKE_TASK_REWARD )
+        {
+            firebase::admob::rewarded_video::RewardItem reward;
+            reward.amount = 1.0f;
+            reward.reward_type = "coins";
+            ((firebase::admob::rewarded_video::Listener*)listener)->OnRewarded(reward);
+        }
+        if( task.m_Presentation >= 0 )
+            DispatchPresentationState(ad, listener, task.m_Presentation);
+        if( task.m_Flags & FAKE_TASK_BOX )
+            DispatchBoundingBox(ad, listener, box);
+    }
+
+    if( task.m_Future )
+    {
+        g_FutureApi.Complete(task.m_Future, task.m_Error, task.m_Message);
+        g_FutureApi.ReleaseFuture(task.m_Future);
+    }
+}
+
+static void CallbackThread(void* arg)
+{
+    (void)arg;
+    g_IsCallbackThread = 1;
+
+    dmMutex::Lock(g_Fake.m_Mutex);
+    while( g_Fake.m_Running )
+    {
+        if( g_Fake.m_Tasks.Empty() )
+        {
+            dmConditionVariable::Wait(g_Fake.m_Cond, g_Fake.m_Mutex);
+            continue;
+        }
+
+        uint32_t next = 0;
+        for( uint32_t i = 1; i < g_Fake.m_Tasks.Size(); ++i)
+        {
+            if( g_Fake.m_Tasks[i].m_Time < g_Fake.m_Tasks[next].m_Time )
+                next = i;
+        }
+
+        uint64_t now = dmTime::GetTime();
+        if( g_Fake.m_Tasks[next].m_Time > now )
+        {
+            uint64_t wait = g_Fake.m_Tasks[next].m_Time - now;
+            dmMutex::Unlock(g_Fake.m_Mutex);
+            dmTime::Sleep((uint32_t)(wait < 1000 ? wait : 1000));
+            dmMutex::Lock(g_Fake.m_Mutex);
+            continue;
+        }
+
+        FakeTask task = g_Fake.m_Tasks[next];
+        g_Fake.m_Tasks.EraseSwap(next);
+        dmAtomicIncrement32(&task.m_Ad->m_InFlight);
+        dmMutex::Unlock(g_Fake.m_Mutex);
+
+        RunTask(task);
+
+        dmAtomicDecrement32(&task.m_Ad->m_InFlight);
+        dmMutex::Lock(g_Fake.m_Mutex);
+    }
+    dmMutex::Unlock(g_Fake.m_Mutex);
+}
+
+// Waits for the callback threads to finish running any task of the ad
+// (unless we're called from one of them, in which case we cannot wait)
+static void WaitForAd(FakeAd* ad)
+{
+    if( g_IsCallbackThread )
+        return;
+    while( dmAtomicGet32(&ad->m_InFlight) != 0 )
+    {
+        dmTime::Sleep(100);
+    }
+}
+
+static void SetListener(FakeAd* ad, void* listener)
+{
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Fake.m_Mutex);
+        ad->m_Listener = listener;
+    }
+    // After this, the previous listener may be deleted
+    WaitForAd(ad);
+}
+
+// Cancels all pending tasks of an ad that is about to be deleted
+static void RemoveAd(FakeAd* ad)
+{
+    if( !g_Fake.m_Mutex )
+        return;
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Fake.m_Mutex);
+        ad->m_Listener = 0;
+        for( uint32_t i = 0; i < g_Fake.m_Tasks.Size(); )
+        {
+            FakeTask& task = g_Fake.m_Tasks[i];
+            if( task.m_Ad != ad )
+            {
+                ++i;
+                continue;
+            }
+            if( task.m_Future )
+                g_FutureApi.ReleaseFuture(task.m_Future);
+            g_Fake.m_Tasks.EraseSwap(i);
+        }
+        for( uint32_t i = 0; i < FAKE_FN_MAX; ++i)
+            ad->m_Last[i] = firebase::Future<void>();
+    }
+    WaitForAd(ad);
+}
+
+static firebase::Future<void> GetLastResult(const FakeAd* ad, FakeAdFn fn)
+{
+    DM_MUTEX_SCOPED_LOCK(g_Fake.m_Mutex);
+    return ad->m_Last[fn];
+}
+
+static int GetPresentationState(const FakeAd* ad)
+{
+    DM_MUTEX_SCOPED_LOCK(g_Fake.m_Mutex);
+    return ad->m_Presentation;
+}
+
+static firebase::admob::BoundingBox GetBoundingBox(const FakeAd* ad)
+{
+    DM_MUTEX_SCOPED_LOCK(g_Fake.m_Mutex);
+    return ad->m_Box;
+}
+
+static uint32_t GetState(const FakeAd* ad)
+{
+    DM_MUTEX_SCOPED_LOCK(g_Fake.m_Mutex);
+    return ad->m_State;
+}
+
+static bool IsView(const FakeAd* ad)
+{
+    return ad->m_Kind == FAKE_AD_BANNER || ad->m_Kind == FAKE_AD_NATIVEEXPRESS;
+}
+
+static firebase::Future<void> Initialize(FakeAd* ad, const firebase::admob::AdSize* size)
+{
+    int error = firebase::admob::kAdMobErrorNone;
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Fake.m_Mutex);
+        if( ad->m_State & FAKE_STATE_INITIALIZED )
+            error = firebase::admob::kAdMobErrorAlreadyInitialized;
+        else if( size )
+        {
+            ad->m_Size = *size;
+            ad->m_Box.width = size->width;
+            ad->m_Box.height = size->height;
+            ad->m_Box.x = 0;
+            ad->m_Box.y = 0;
+        }
+    }
+    // The banner views start out hidden
+    return StartOperation(ad, FAKE_FN_INITIALIZE, error, IsView(ad) ? 0 : -1, FAKE_STATE_INITIALIZED, 0, IsView(ad) ? FAKE_TASK_BOX : 0, 0);
+}
+
+static firebase::Future<void> LoadAd(FakeAd* ad)
+{
+    int error = (GetState(ad) & FAKE_STATE_INITIALIZED) ? firebase::admob::kAdMobErrorNone : firebase::admob::kAdMobErrorUninitialized;
+    return StartOperation(ad, FAKE_FN_LOADAD, error, -1, FAKE_STATE_LOADED, 0, 0, 0);
+}
+
+static firebase::Future<void> Show(FakeAd* ad)
+{
+    uint32_t state = GetState(ad);
+    int error = (state & FAKE_STATE_INITIALIZED) ? firebase::admob::kAdMobErrorNone : firebase::admob::kAdMobErrorUninitialized;
+
+    if( IsView(ad) )
+    {
+        int presentation = (state & FAKE_STATE_LOADED) ? firebase::admob::BannerView::kPresentationStateVisibleWithAd : firebase::admob::BannerView::kPresentationStateVisibleWithoutAd;
+        return StartOperation(ad, FAKE_FN_SHOW, error, presentation, 0, 0, 0, 0);
+    }
+
+    // The fullscreen ads cover the UI for a while, and can only be shown once
+    int presentation = ad->m_Kind == FAKE_AD_INTERSTITIAL ? (int)firebase::admob::InterstitialAd::kPresentationStateCoveringUI : (int)firebase::admob::rewarded_video::kPresentationStateCoveringUI;
+    int result = 0;
+    firebase::Future<void> future = StartOperation(ad, FAKE_FN_SHOW, error, presentation, 0, 0, 0, &result);
+    if( result == firebase::admob::kAdMobErrorNone )
+    {
+        uint64_t delay;
+        {
+            DM_MUTEX_SCOPED_LOCK(g_Fake.m_Mutex);
+            delay = RandomLatency() + (uint64_t)g_Fake.m_Params.m_ShowDuration * 1000;
+        }
+        uint32_t flags = ad->m_Kind == FAKE_AD_REWARDEDVIDEO ? FAKE_TASK_REWARD : 0;
+        ScheduleEvent(ad, delay, 0, FAKE_STATE_LOADED, flags);
+    }
+    return future;
+}
+
+static firebase::Future<void> Hide(FakeAd* ad)
+{
+    return StartOperation(ad, FAKE_FN_HIDE, firebase::admob::kAdMobErrorNone, 0, 0, 0, 0, 0);
+}
+
+static firebase::Future<void> Pause(FakeAd* ad)
+{
+    return StartOperation(ad, FAKE_FN_PAUSE, firebase::admob::kAdMobErrorNone, -1, 0, 0, 0, 0);
+}
+
+static firebase::Future<void> Resume(FakeAd* ad)
+{
+    return StartOperation(ad, FAKE_FN_RESUME, firebase::admob::kAdMobErrorNone, -1, 0, 0, 0, 0);
+}
+
+static firebase::Future<void> Destroy(FakeAd* ad)
+{
+    return StartOperation(ad, FAKE_FN_DESTROY, firebase::admob::kAdMobErrorNone, 0, 0, FAKE_STATE_INITIALIZED | FAKE_STATE_LOADED, 0, 0);
+}
+
+static firebase::Future<void> MoveTo(FakeAd* ad, int x, int y)
+{
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Fake.m_Mutex);
+        ad->m_Box.x = x;
+        ad->m_Box.y = y;
+    }
+    return StartOperation(ad, FAKE_FN_MOVETO, firebase::admob::kAdMobErrorNone, -1, 0, 0, FAKE_TASK_BOX, 0);
+}
+
+static firebase::Future<void> MoveTo(FakeAd* ad, int position)
+{
+    int x, y;
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Fake.m_Mutex);
+        int w = (int)g_Fake.m_Params.m_ScreenWidth;
+        int h = (int)g_Fake.m_Params.m_ScreenHeight;
+        int aw = ad->m_Box.width;
+        int ah = ad->m_Box.height;
+        switch(position)
+        {
+        case firebase::admob::BannerView::kPositionTop:         x = (w - aw) / 2; y = 0; break;
+        case firebase::admob::BannerView::kPositionBottom:      x = (w - aw) / 2; y = h - ah; break;
+        case firebase::admob::BannerView::kPositionTopLeft:     x = 0; y = 0; break;
+        case firebase::admob::BannerView::kPositionTopRight:    x = w - aw; y = 0; break;
+        case firebase::admob::BannerView::kPositionBottomLeft:  x = 0; y = h - ah; break;
+        default:                                                x = w - aw; y = h - ah; break;
+        }
+    }
+    return MoveTo(ad, x, y);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// Setup
+
+void FakeBackendGetDefaultParams(FakeBackendParams* params)
+{
+    memset(params, 0, sizeof(*params));
+    params->m_FillRate = 0.9f;
+    params->m_ErrorRate = 0.0f;
+    params->m_ErrorCode = firebase::admob::kAdMobErrorNetworkError;
+    params->m_StuckRate = 0.0f;
+    params->m_LatencyMin = 50;
+    params->m_LatencyMax = 250;
+    params->m_LatencyTailRate = 0.05f;
+    params->m_LatencyTail = 2000;
+    params->m_ShowDuration = 3000;
+    params->m_CallbackThreads = 2;
+    params->m_ScreenWidth = 720;
+    params->m_ScreenHeight = 1280;
+    params->m_Seed = 0x1234567;
+}
+
+void FakeBackendGetConfigParams(dmConfigFile::HConfig config, FakeBackendParams* params)
+{
+    FakeBackendGetDefaultParams(params);
+    params->m_FillRate          = dmConfigFile::GetFloat(config, "admob.fake_fill_rate", params->m_FillRate);
+    params->m_ErrorRate         = dmConfigFile::GetFloat(config, "admob.fake_error_rate", params->m_ErrorRate);
+    params->m_ErrorCode         = dmConfigFile::GetInt(config, "admob.fake_error_code", params->m_ErrorCode);
+    params->m_StuckRate         = dmConfigFile::GetFloat(config, "admob.fake_stuck_rate", params->m_StuckRate);
+    params->m_LatencyMin        = (uint32_t)dmConfigFile::GetInt(config, "admob.fake_latency_min", params->m_LatencyMin);
+    params->m_LatencyMax        = (uint32_t)dmConfigFile::GetInt(config, "admob.fake_latency_max", params->m_LatencyMax);
+    params->m_LatencyTailRate   = dmConfigFile::GetFloat(config, "admob.fake_latency_tail_rate", params->m_LatencyTailRate);
+    params->m_LatencyTail       = (uint32_t)dmConfigFile::GetInt(config, "admob.fake_latency_tail", params->m_LatencyTail);
+    params->m_ShowDuration      = (uint32_t)dmConfigFile::GetInt(config, "admob.fake_show_duration", params->m_ShowDuration);
+    params->m_CallbackThreads   = (uint32_t)dmConfigFile::GetInt(config, "admob.fake_callback_threads", params->m_CallbackThreads);
+    params->m_Seed              = (uint32_t)dmConfigFile::GetInt(config, "admob.fake_seed", params->m_Seed);
+    params->m_ScreenWidth       = (uint32_t)dmConfigFile::GetInt(config, "display.width", params->m_ScreenWidth);
+    params->m_ScreenHeight      = (uint32_t)dmConfigFile::GetInt(config, "display.height", params->m_ScreenHeight);
+}
+
+void FakeBackendSetParams(const FakeBackendParams& params)
+{
+    g_Fake.m_Params = params;
+    g_Fake.m_HasParams = true;
+}
+
+static void StartBackend()
+{
+    if( g_Fake.m_Running )
+        return;
+
+    if( !g_Fake.m_HasParams )
+        FakeBackendGetDefaultParams(&g_Fake.m_Params);
+
+    g_FutureApi.Init();
+    g_Fake.m_Mutex = dmMutex::New();
+    g_Fake.m_Cond = dmConditionVariable::New();
+    g_Fake.m_Tasks.SetCapacity(32);
+    g_Fake.m_Random = g_Fake.m_Params.m_Seed ? g_Fake.m_Params.m_Seed : 1;
+    g_Fake.m_Running = true;
+
+    uint32_t num_threads = g_Fake.m_Params.m_CallbackThreads;
+    if( num_threads < 1 )
+        num_threads = 1;
+    if( num_threads > FAKE_MAX_THREADS )
+        num_threads = FAKE_MAX_THREADS;
+    g_Fake.m_NumThreads = num_threads;
+    for( uint32_t i = 0; i < num_threads; ++i)
+    {
+        g_Fake.m_Threads[i] = dmThread::New(CallbackThread, 0x20000, 0, "admob_fake");
+    }
+    dmLogInfo("AdMob fake backend started with %u callback threads", num_threads);
+}
+
+static void StopBackend()
+{
+    if( !g_Fake.m_Running )
+        return;
+
+    dmMutex::Lock(g_Fake.m_Mutex);
+    g_Fake.m_Running = false;
+    dmConditionVariable::Broadcast(g_Fake.m_Cond);
+    dmMutex::Unlock(g_Fake.m_Mutex);
+
+    for( uint32_t i = 0; i < g_Fake.m_NumThreads; ++i)
+    {
+        dmThread::Join(g_Fake.m_Threads[i]);
+    }
+    g_Fake.m_NumThreads = 0;
+
+    for( uint32_t i = 0; i < g_Fake.m_Tasks.Size(); ++i)
+    {
+        if( g_Fake.m_Tasks[i].m_Future )
+            g_FutureApi.ReleaseFuture(g_Fake.m_Tasks[i].m_Future);
+    }
+    g_Fake.m_Tasks.SetSize(0);
+
+    dmConditionVariable::Delete(g_Fake.m_Cond);
+    dmMutex::Delete(g_Fake.m_Mutex);
+    g_Fake.m_Cond = 0;
+    g_Fake.m_Mutex = 0;
+    g_FutureApi.Finalize();
+}
+
+} // AdMobExtension
+
+////////////////////////////////////////////////////////////////////////////////////////
+// The Firebase api
+
+namespace firebase {
+
+namespace detail {
+FutureApiInterface::~FutureApiInterface() {}
+}
+
+App::App() : data_(0) {}
+App::~App() {}
+
+App* App::Create(const AppOptions& options)
+{
+    App* app = new App();
+    app->options_ = options;
+    app->name_ = "__FIRAPP_DEFAULT";
+    return app;
+}
+
+// Runs the initializers in order, on the calling thread. The future is complete when Initialize() returns.
+struct ModuleInitializerData
+{
+    Future<void> m_Last;
+};
+
+ModuleInitializer::ModuleInitializer() : data_(new ModuleInitializerData) {}
+ModuleInitializer::~ModuleInitializer() { delete data_; }
+
+Future<void> ModuleInitializer::Initialize(::firebase::App* app, void* context, const InitializerFn* init_fns, size_t init_fns_count)
+{
+    size_t succeeded = 0;
+    while( succeeded < init_fns_count && init_fns[succeeded](app, context) == kInitResultSuccess )
+        ++succeeded;
+
+    // The futures are available once the admob initializer has started the backend
+    FutureHandle handle = AdMobExtension::g_FutureApi.Alloc();
+    if( handle )
+    {
+        data_->m_Last = Future<void>(&AdMobExtension::g_FutureApi, handle);
+        AdMobExtension::g_FutureApi.Complete(handle, (int)(init_fns_count - succeeded), 0);
+    }
+    return data_->m_Last;
+}
+
+Future<void> ModuleInitializer::Initialize(::firebase::App* app, void* context, InitializerFn init_fn)
+{
+    return Initialize(app, context, &init_fn, 1);
+}
+
+Future<void> ModuleInitializer::InitializeLastResult()
+{
+    return data_->m_Last;
+}
+
+namespace admob {
+
+InitResult Initialize(const ::firebase::App& /*app*/)
+{
+    AdMobExtension::StartBackend();
+    return kInitResultSuccess;
+}
+
+InitResult Initialize(const ::firebase::App& /*app*/, const char* /*admob_app_id*/)
+{
+    AdMobExtension::StartBackend();
+    return kInitResultSuccess;
+}
+
+InitResult Initialize()
+{
+    AdMobExtension::StartBackend();
+    return kInitResultSuccess;
+}
+
+InitResult Initialize(const char* /*admob_app_id*/)
+{
+    AdMobExtension::StartBackend();
+    return kInitResultSuccess;
+}
+
+void Terminate()
+{
+    AdMobExtension::StopBackend();
+}
+
+namespace internal {
+class BannerViewInternal : public AdMobExtension::FakeAd
+{
+public:
+    BannerViewInternal(BannerView* owner) : FakeAd(AdMobExtension::FAKE_AD_BANNER, owner) {}
+};
+
+class InterstitialAdInternal : public AdMobExtension::FakeAd
+{
+public:
+    InterstitialAdInternal(InterstitialAd* owner) : FakeAd(AdMobExtension::FAKE_AD_INTERSTITIAL, owner) {}
+};
+
+class NativeExpressAdViewInternal : public AdMobExtension::FakeAd
+{
+public:
+    NativeExpressAdViewInternal(NativeExpressAdView* owner) : FakeAd(AdMobExtension::FAKE_AD_NATIVEEXPRESS, owner) {}
+};
+} // internal
+
+////////////////////////////////////////////////////////
+// BannerView
+
+BannerView::Listener::~Listener() {}
+
+BannerView::BannerView() : internal_(new internal::BannerViewInternal(this)) {}
+BannerView::~BannerView()
+{
+    AdMobExtension::RemoveAd(internal_);
+    delete internal_;
+}
+
+Future<void> BannerView::Initialize(AdParent /*parent*/, const char* /*ad_unit_id*/, AdSize size)  { return AdMobExtension::Initialize(internal_, &size); }
+Future<void> BannerView::InitializeLastResult() const   { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_INITIALIZE); }
+Future<void> BannerView::LoadAd(const AdRequest& /*request*/) { return AdMobExtension::LoadAd(internal_); }
+Future<void> BannerView::LoadAdLastResult() const       { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_LOADAD); }
+Future<void> BannerView::Hide()                         { return AdMobExtension::Hide(internal_); }
+Future<void> BannerView::HideLastResult() const         { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_HIDE); }
+Future<void> BannerView::Show()                         { return AdMobExtension::Show(internal_); }
+Future<void> BannerView::ShowLastResult() const         { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_SHOW); }
+Future<void> BannerView::Pause()                        { return AdMobExtension::Pause(internal_); }
+Future<void> BannerView::PauseLastResult() const        { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_PAUSE); }
+Future<void> BannerView::Resume()                       { return AdMobExtension::Resume(internal_); }
+Future<void> BannerView::ResumeLastResult() const       { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_RESUME); }
+Future<void> BannerView::Destroy()                      { return AdMobExtension::Destroy(internal_); }
+Future<void> BannerView::DestroyLastResult() const      { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_DESTROY); }
+Future<void> BannerView::MoveTo(int x, int y)           { return AdMobExtension::MoveTo(internal_, x, y); }
+Future<void> BannerView::MoveTo(Position position)      { return AdMobExtension::MoveTo(internal_, (int)position); }
+Future<void> BannerView::MoveToLastResult() const       { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_MOVETO); }
+BannerView::PresentationState BannerView::presentation_state() const { return (PresentationState)AdMobExtension::GetPresentationState(internal_); }
+BoundingBox BannerView::bounding_box() const            { return AdMobExtension::GetBoundingBox(internal_); }
+void BannerView::SetListener(Listener* listener)        { AdMobExtension::SetListener(internal_, listener); }
+
+////////////////////////////////////////////////////////
+// NativeExpressAdView
+
+NativeExpressAdView::Listener::~Listener() {}
+
+NativeExpressAdView::NativeExpressAdView() : internal_(new internal::NativeExpressAdViewInternal(this)) {}
+NativeExpressAdView::~NativeExpressAdView()
+{
+    AdMobExtension::RemoveAd(internal_);
+    delete internal_;
+}
+
+Future<void> NativeExpressAdView::Initialize(AdParent /*parent*/, const char* /*ad_unit_id*/, AdSize size) { return AdMobExtension::Initialize(internal_, &size); }
+Future<void> NativeExpressAdView::InitializeLastResult() const  { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_INITIALIZE); }
+Future<void> NativeExpressAdView::LoadAd(const AdRequest& /*request*/) { return AdMobExtension::LoadAd(internal_); }
+Future<void> NativeExpressAdView::LoadAdLastResult() const      { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_LOADAD); }
+Future<void> NativeExpressAdView::Hide()                        { return AdMobExtension::Hide(internal_); }
+Future<void> NativeExpressAdView::HideLastResult() const        { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_HIDE); }
+Future<void> NativeExpressAdView::Show()                        { return AdMobExtension::Show(internal_); }
+Future<void> NativeExpressAdView::ShowLastResult() const        { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_SHOW); }
+Future<void> NativeExpressAdView::Pause()                       { return AdMobExtension::Pause(internal_); }
+Future<void> NativeExpressAdView::PauseLastResult() const       { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_PAUSE); }
+Future<void> NativeExpressAdView::Resume()                      { return AdMobExtension::Resume(internal_); }
+Future<void> NativeExpressAdView::ResumeLastResult() const      { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_RESUME); }
+Future<void> NativeExpressAdView::Destroy()                     { return AdMobExtension::Destroy(internal_); }
+Future<void> NativeExpressAdView::DestroyLastResult() const     { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_DESTROY); }
+Future<void> NativeExpressAdView::MoveTo(int x, int y)          { return AdMobExtension::MoveTo(internal_, x, y); }
+Future<void> NativeExpressAdView::MoveTo(Position position)     { return AdMobExtension::MoveTo(internal_, (int)position); }
+Future<void> NativeExpressAdView::MoveToLastResult() const      { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_MOVETO); }
+NativeExpressAdView::PresentationState NativeExpressAdView::GetPresentationState() const { return (PresentationState)AdMobExtension::GetPresentationState(internal_); }
+BoundingBox NativeExpressAdView::GetBoundingBox() const         { return AdMobExtension::GetBoundingBox(internal_); }
+void NativeExpressAdView::SetListener(Listener* listener)       { AdMobExtension::SetListener(internal_, listener); }
+
+////////////////////////////////////////////////////////
+// InterstitialAd
+
+InterstitialAd::Listener::~Listener() {}
+
+InterstitialAd::InterstitialAd() : internal_(new internal::InterstitialAdInternal(this)) {}
+InterstitialAd::~InterstitialAd()
+{
+    AdMobExtension::RemoveAd(internal_);
+    delete internal_;
+}
+
+Future<void> InterstitialAd::Initialize(AdParent /*parent*/, const char* /*ad_unit_id*/) { return AdMobExtension::Initialize(internal_, 0); }
+Future<void> InterstitialAd::InitializeLastResult() const   { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_INITIALIZE); }
+Future<void> InterstitialAd::LoadAd(const AdRequest& /*request*/) { return AdMobExtension::LoadAd(internal_); }
+Future<void> InterstitialAd::LoadAdLastResult() const       { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_LOADAD); }
+Future<void> InterstitialAd::Show()                         { return AdMobExtension::Show(internal_); }
+Future<void> InterstitialAd::ShowLastResult() const         { return AdMobExtension::GetLastResult(internal_, AdMobExtension::FAKE_FN_SHOW); }
+InterstitialAd::PresentationState InterstitialAd::presentation_state() const { return (PresentationState)AdMobExtension::GetPresentationState(internal_); }
+void InterstitialAd::SetListener(Listener* listener)        { AdMobExtension::SetListener(internal_, listener); }
+
+////////////////////////////////////////////////////////
+// Rewarded video
+
+namespace rewarded_video {
+
+Listener::~Listener() {}
+
+static AdMobExtension::FakeAd* GetRewardedVideo()
+{
+    if( !AdMobExtension::g_RewardedVideo )
+        AdMobExtension::g_RewardedVideo = new AdMobExtension::FakeAd(AdMobExtension::FAKE_AD_REWARDEDVIDEO, 0);
+    return AdMobExtension::g_RewardedVideo;
+}
+
+Future<void> Initialize()                       { return AdMobExtension::Initialize(GetRewardedVideo(), 0); }
+Future<void> InitializeLastResult()             { return AdMobExtension::GetLastResult(GetRewardedVideo(), AdMobExtension::FAKE_FN_INITIALIZE); }
+Future<void> LoadAd(const char* /*ad_unit_id*/, const AdRequest& /*request*/) { return AdMobExtension::LoadAd(GetRewardedVideo()); }
+Future<void> LoadAdLastResult()                 { return AdMobExtension::GetLastResult(GetRewardedVideo(), AdMobExtension::FAKE_FN_LOADAD); }
+Future<void> Show(AdParent /*parent*/)              { return AdMobExtension::Show(GetRewardedVideo()); }
+Future<void> ShowLastResult()                   { return AdMobExtension::GetLastResult(GetRewardedVideo(), AdMobExtension::FAKE_FN_SHOW); }
+Future<void> Pause()                            { return AdMobExtension::Pause(GetRewardedVideo()); }
+Future<void> PauseLastResult()                  { return AdMobExtension::GetLastResult(GetRewardedVideo(), AdMobExtension::FAKE_FN_PAUSE); }
+Future<void> Resume()                           { return AdMobExtension::Resume(GetRewardedVideo()); }
+Future<void> ResumeLastResult()                 { return AdMobExtension::GetLastResult(GetRewardedVideo(), AdMobExtension::FAKE_FN_RESUME); }
+PresentationState presentation_state()          { return (PresentationState)AdMobExtension::GetPresentationState(GetRewardedVideo()); }
+void SetListener(Listener* listener)            { AdMobExtension::SetListener(GetRewardedVideo(), listener); }
+
+void Destroy()
+{
+    if( !AdMobExtension::g_RewardedVideo )
+        return;
+    AdMobExtension::RemoveAd(AdMobExtension::g_RewardedVideo);
+    delete AdMobExtension::g_RewardedVideo;
+    AdMobExtension::g_RewardedVideo = 0;
+}
+
+} // rewarded_video
+} // admob
+} // firebase
+
+#endif
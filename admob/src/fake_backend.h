@@ -0,0 +1,38 @@
+#pragma once
+
+// A stand-in for the Firebase AdMob sdk, for host builds (compiled with ADMOB_FAKE_BACKEND)
+// It implements the firebase::admob classes and firebase::Future, and completes the operations
+// on a set of callback threads, after a random latency.
+
+#if defined(ADMOB_FAKE_BACKEND)
+
+#include <dmsdk/sdk.h>
+
+namespace AdMobExtension {
+
+struct FakeBackendParams
+{
+    float       m_FillRate;         // Probability that a load (without an injected error) returns an ad
+    float       m_ErrorRate;        // Probability that an operation fails with m_ErrorCode
+    int         m_ErrorCode;        // The injected error (firebase::admob::AdMobError)
+    float       m_StuckRate;        // Probability that an operation never completes
+    uint32_t    m_LatencyMin;       // Latency of each operation (ms), uniformly distributed in [min, max]
+    uint32_t    m_LatencyMax;
+    float       m_LatencyTailRate;  // Probability that m_LatencyTail (ms) is added to the latency
+    uint32_t    m_LatencyTail;
+    uint32_t    m_ShowDuration;     // How long (ms) an interstitial/rewarded video stays on screen
+    uint32_t    m_CallbackThreads;  // Number of threads completing the futures and calling the listeners
+    uint32_t    m_ScreenWidth;      // Used to place the banners
+    uint32_t    m_ScreenHeight;
+    uint32_t    m_Seed;
+};
+
+void FakeBackendGetDefaultParams(FakeBackendParams* params);
+void FakeBackendGetConfigParams(dmConfigFile::HConfig config, FakeBackendParams* params);
+
+// Set the parameters before firebase::admob::Initialize(), which starts the callback threads
+void FakeBackendSetParams(const FakeBackendParams& params);
+
+}
+
+#endif
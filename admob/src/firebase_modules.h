@@ -0,0 +1,13 @@
+#pragma once
+
+// The Firebase C++ Analytics and Remote Config libraries are only shipped for Android (see lib/android),
+// so the features using them are only compiled there.
+// Remote Config also needs the firebase-config jar, which isn't in lib/android. It's only compiled if the game
+// defines ADMOB_REMOTE_CONFIG in its app manifest (and adds the jar), see the README.
+
+#if defined(DM_PLATFORM_ANDROID)
+    #define ADMOB_WITH_ANALYTICS
+    #if defined(ADMOB_REMOTE_CONFIG)
+        #define ADMOB_WITH_REMOTE_CONFIG
+    #endif
+#endif
@@ -0,0 +1,409 @@
+#include "futures.h"
+
+#include <dmsdk/dlib/atomic.h>
+#include <dmsdk/dlib/mutex.h>
+#include <dmsdk/dlib/time.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "enums.h"
+
+namespace AdMobExtension {
+
+enum FutureNodeType
+{
+    FUTURE_NODE_SDK,        // Waits for an sdk future
+    FUTURE_NODE_THEN,       // Waits for its input, and then for the sdk future returned by the step
+    FUTURE_NODE_ALL,
+    FUTURE_NODE_ANY,
+    FUTURE_NODE_TIMEOUT,
+};
+
+enum FutureNodeState
+{
+    FUTURE_STATE_FREE,
+    FUTURE_STATE_PENDING,
+    FUTURE_STATE_COMPLETE,  // Holds its result until its consumer is attached
+};
+
+static const uint32_t FUTURE_MESSAGE_SIZE = 64;
+static const uint32_t FUTURE_MAX_EXPIRED = 16; // Timeouts handled per FutureUpdate()
+
+struct FutureNode
+{
+    uint64_t            m_Deadline;         // Timeout nodes
+    FutureStepFn        m_Step;             // Then nodes
+    void*               m_StepUserData;
+    HFuture             m_Parent;           // The consumer: a parent node, or a callback
+    FutureCompletionFn  m_Callback;
+    void*               m_UserData;
+    uint32_t            m_Pending;          // All/any nodes: the inputs that haven't completed
+    uint32_t            m_NextFree;         // Index + 1
+    int                 m_Error;
+    uint16_t            m_Generation;
+    uint8_t             m_Type;
+    uint8_t             m_State;
+    uint8_t             m_Stepped;          // Then nodes: the step was called
+    char                m_ErrorMessage[FUTURE_MESSAGE_SIZE];
+};
+
+struct Futures
+{
+    FutureNode*         m_Nodes;
+    uint32_t            m_Capacity;
+    uint32_t            m_FirstFree;        // Index + 1 (0 if the pool is full)
+    int32_atomic_t      m_NumTimeouts;      // Pending timeout nodes
+    dmMutex::HMutex     m_Mutex;
+};
+
+static Futures g_Futures;
+
+static void SetMessage(char* dst, const char* src)
+{
+    if( !src )
+        src = "";
+    size_t length = strlen(src);
+    if( length > FUTURE_MESSAGE_SIZE - 1 )
+        length = FUTURE_MESSAGE_SIZE - 1;
+    memcpy(dst, src, length);
+    dst[length] = 0;
+}
+
+static HFuture MakeHandle(uint32_t index, uint16_t generation)
+{
+    return ((uint32_t)generation << 16) | (index + 1);
+}
+
+// Returns 0 if the node was freed since. Called with the lock held
+static FutureNode* GetNode(HFuture handle)
+{
+    uint32_t index = handle & 0xFFFF;
+    if( index == 0 || index > g_Futures.m_Capacity )
+        return 0;
+    FutureNode* node = &g_Futures.m_Nodes[index - 1];
+    if( node->m_State == FUTURE_STATE_FREE || node->m_Generation != (uint16_t)(handle >> 16) )
+        return 0;
+    return node;
+}
+
+// Called with the lock held
+static HFuture AllocNode(FutureNodeType type)
+{
+    if( !g_Futures.m_FirstFree )
+    {
+        dmLogError("AdMob: the future pool is full (%u nodes)", g_Futures.m_Capacity);
+        return 0;
+    }
+    uint32_t index = g_Futures.m_FirstFree - 1;
+    FutureNode* node = &g_Futures.m_Nodes[index];
+    g_Futures.m_FirstFree = node->m_NextFree;
+
+    uint16_t generation = node->m_Generation;
+    memset(node, 0, sizeof(*node));
+    node->m_Generation = generation;
+    node->m_Type = type;
+    node->m_State = FUTURE_STATE_PENDING;
+    return MakeHandle(index, generation);
+}
+
+// Called with the lock held
+static void FreeNode(FutureNode* node)
+{
+    node->m_State = FUTURE_STATE_FREE;
+    node->m_Generation++; // The late inputs of the node are dropped
+    node->m_NextFree = g_Futures.m_FirstFree;
+    g_Futures.m_FirstFree = (uint32_t)(node - g_Futures.m_Nodes) + 1;
+}
+
+// Frees the inputs that are still pending when their consumer completes: the inputs of a timeout that expired, or the
+// other inputs of an 'any' node that succeeded. Their late results then find a stale handle, and a stuck sdk future
+// doesn't hold on to its node. Called with the lock held
+static void ReleaseInputs(HFuture handle)
+{
+    for( uint32_t i = 0; i < g_Futures.m_Capacity; ++i )
+    {
+        FutureNode* node = &g_Futures.m_Nodes[i];
+        if( node->m_State != FUTURE_STATE_PENDING || node->m_Parent != handle )
+            continue;
+        if( node->m_Type == FUTURE_NODE_TIMEOUT )
+            dmAtomicDecrement32(&g_Futures.m_NumTimeouts);
+        HFuture input = MakeHandle(i, node->m_Generation);
+        FreeNode(node);
+        ReleaseInputs(input);
+    }
+}
+
+// The consumer of the inputs that can't be passed on (e.g. the pool was full)
+static void Discard(int error, const char* error_message, void* user_data)
+{
+    (void)error; (void)error_message; (void)user_data;
+}
+
+// Returns true if the result completes the node
+static bool Accept(FutureNode* node, int error)
+{
+    switch(node->m_Type)
+    {
+    case FUTURE_NODE_ALL:
+        return error != 0 || --node->m_Pending == 0;
+    case FUTURE_NODE_ANY:
+        return error == 0 || --node->m_Pending == 0;
+    default:
+        return true; // The single input decides
+    }
+}
+
+static void WaitFor(HFuture handle, const firebase::FutureBase& future);
+
+// Passes a result to the node waiting for it, and on up the chain of the nodes it completes
+static void Notify(HFuture handle, int error, const char* error_message)
+{
+    if( !g_Futures.m_Nodes )
+        return; // Finalized
+
+    char message[FUTURE_MESSAGE_SIZE];
+    SetMessage(message, error_message);
+
+    while( true )
+    {
+        FutureStepFn step = 0;
+        FutureCompletionFn callback = 0;
+        void* user_data = 0;
+        {
+            DM_MUTEX_SCOPED_LOCK(g_Futures.m_Mutex);
+            FutureNode* node = GetNode(handle);
+            if( !node || node->m_State != FUTURE_STATE_PENDING )
+                return; // Already complete (e.g. timed out, or another input of an 'any' node succeeded)
+
+            if( node->m_Type == FUTURE_NODE_THEN && !node->m_Stepped && error == 0 )
+            {
+                node->m_Stepped = 1;
+                step = node->m_Step;
+                user_data = node->m_StepUserData;
+            }
+            else
+            {
+                if( !Accept(node, error) )
+                    return;
+                ReleaseInputs(handle);
+
+                if( node->m_Type == FUTURE_NODE_TIMEOUT )
+                    dmAtomicDecrement32(&g_Futures.m_NumTimeouts);
+
+                if( node->m_Parent )
+                {
+                    handle = node->m_Parent;
+                    FreeNode(node);
+                    continue;
+                }
+                if( !node->m_Callback )
+                {
+                    node->m_State = FUTURE_STATE_COMPLETE;
+                    node->m_Error = error;
+                    SetMessage(node->m_ErrorMessage, message);
+                    return;
+                }
+                callback = node->m_Callback;
+                user_data = node->m_UserData;
+                FreeNode(node);
+            }
+        }
+
+        // Outside of the lock, since these may complete futures themselves
+        if( step )
+            WaitFor(handle, step(user_data));
+        else
+            callback(error, message, user_data);
+        return;
+    }
+}
+
+static void OnSdkCompletion(const firebase::FutureBase& future, void* user_data)
+{
+    Notify((HFuture)(uintptr_t)user_data, future.error(), future.error_message());
+}
+
+static void WaitFor(HFuture handle, const firebase::FutureBase& future)
+{
+    if( future.status() == firebase::kFutureStatusInvalid )
+    {
+        Notify(handle, ADMOB_ERROR_INTERNALERROR, "Invalid future");
+        return;
+    }
+    future.OnCompletion(OnSdkCompletion, (void*)(uintptr_t)handle);
+}
+
+// Makes the parent node (or the callback) the consumer of the future, and passes the result on if it's already complete
+static void Attach(HFuture future, HFuture parent, FutureCompletionFn callback, void* user_data)
+{
+    int error;
+    char message[FUTURE_MESSAGE_SIZE];
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Futures.m_Mutex);
+        FutureNode* node = GetNode(future);
+        if( node && node->m_State == FUTURE_STATE_PENDING )
+        {
+            node->m_Parent = parent;
+            node->m_Callback = callback;
+            node->m_UserData = user_data;
+            return;
+        }
+
+        if( node )
+        {
+            error = node->m_Error;
+            SetMessage(message, node->m_ErrorMessage);
+            FreeNode(node);
+        }
+        else
+        {
+            error = ADMOB_ERROR_INTERNALERROR;
+            SetMessage(message, "No future node");
+        }
+    }
+
+    if( parent )
+        Notify(parent, error, message);
+    else if( callback )
+        callback(error, message, user_data);
+}
+
+static HFuture Combine(FutureNodeType type, const HFuture* futures, uint32_t count)
+{
+    HFuture handle;
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Futures.m_Mutex);
+        handle = AllocNode(type);
+        FutureNode* node = GetNode(handle);
+        if( node )
+        {
+            node->m_Pending = count;
+            if( count == 0 )
+            {
+                node->m_State = FUTURE_STATE_COMPLETE;
+                node->m_Error = type == FUTURE_NODE_ALL ? ADMOB_ERROR_NONE : ADMOB_ERROR_INVALIDREQUEST;
+            }
+        }
+    }
+
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        Attach(futures[i], handle, handle ? 0 : Discard, 0);
+    }
+    return handle;
+}
+
+void FutureInit(uint32_t capacity)
+{
+    if( capacity > 0xFFFF )
+        capacity = 0xFFFF;
+    memset(&g_Futures, 0, sizeof(g_Futures));
+    g_Futures.m_Mutex = dmMutex::New();
+    g_Futures.m_Capacity = capacity;
+    if( !capacity )
+        return;
+
+    g_Futures.m_Nodes = (FutureNode*)Malloc(sizeof(FutureNode) * capacity);
+    memset(g_Futures.m_Nodes, 0, sizeof(FutureNode) * capacity);
+    for( uint32_t i = 0; i < capacity; ++i )
+    {
+        g_Futures.m_Nodes[i].m_NextFree = i + 1 < capacity ? i + 2 : 0;
+    }
+    g_Futures.m_FirstFree = 1;
+}
+
+void FutureFinalize()
+{
+    if( g_Futures.m_Nodes )
+        Free(g_Futures.m_Nodes);
+    if( g_Futures.m_Mutex )
+        dmMutex::Delete(g_Futures.m_Mutex);
+    memset(&g_Futures, 0, sizeof(g_Futures));
+}
+
+void FutureUpdate()
+{
+    if( dmAtomicGet32(&g_Futures.m_NumTimeouts) == 0 )
+        return;
+
+    HFuture expired[FUTURE_MAX_EXPIRED];
+    uint32_t count = 0;
+    uint64_t time = dmTime::GetTime();
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Futures.m_Mutex);
+        for( uint32_t i = 0; i < g_Futures.m_Capacity && count < FUTURE_MAX_EXPIRED; ++i )
+        {
+            FutureNode* node = &g_Futures.m_Nodes[i];
+            if( node->m_Type == FUTURE_NODE_TIMEOUT && node->m_State == FUTURE_STATE_PENDING && time >= node->m_Deadline )
+                expired[count++] = MakeHandle(i, node->m_Generation);
+        }
+    }
+
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        Notify(expired[i], ADMOB_ERROR_TIMEOUT, "The future timed out");
+    }
+}
+
+HFuture FutureFrom(const firebase::FutureBase& future)
+{
+    HFuture handle;
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Futures.m_Mutex);
+        handle = AllocNode(FUTURE_NODE_SDK);
+    }
+    if( handle )
+        WaitFor(handle, future);
+    return handle;
+}
+
+HFuture FutureThen(HFuture future, FutureStepFn step, void* user_data)
+{
+    HFuture handle;
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Futures.m_Mutex);
+        handle = AllocNode(FUTURE_NODE_THEN);
+        FutureNode* node = GetNode(handle);
+        if( node )
+        {
+            node->m_Step = step;
+            node->m_StepUserData = user_data;
+        }
+    }
+    Attach(future, handle, handle ? 0 : Discard, 0);
+    return handle;
+}
+
+HFuture FutureWhenAll(const HFuture* futures, uint32_t count)
+{
+    return Combine(FUTURE_NODE_ALL, futures, count);
+}
+
+HFuture FutureWhenAny(const HFuture* futures, uint32_t count)
+{
+    return Combine(FUTURE_NODE_ANY, futures, count);
+}
+
+HFuture FutureTimeout(HFuture future, uint64_t timeout)
+{
+    HFuture handle;
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Futures.m_Mutex);
+        handle = AllocNode(FUTURE_NODE_TIMEOUT);
+        FutureNode* node = GetNode(handle);
+        if( node )
+        {
+            node->m_Deadline = dmTime::GetTime() + timeout;
+            dmAtomicIncrement32(&g_Futures.m_NumTimeouts);
+        }
+    }
+    Attach(future, handle, handle ? 0 : Discard, 0);
+    return handle;
+}
+
+void FutureOnCompletion(HFuture future, FutureCompletionFn fn, void* user_data)
+{
+    Attach(future, 0, fn, user_data);
+}
+
+}
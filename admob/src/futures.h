@@ -0,0 +1,50 @@
+#pragma once
+
+#include <dmsdk/sdk.h>
+#include "firebase/future.h"
+
+namespace AdMobExtension {
+
+// Continuations over the sdk futures, to chain and combine sdk calls without writing a callback for each step.
+// The completion state lives in a fixed pool of nodes, allocated in FutureInit(), so no step allocates.
+//
+// A node completes once, with an error (0 on success, otherwise a firebase::admob::AdMobError, or ADMOB_ERROR_TIMEOUT)
+// and an error message. Each handle must be passed on exactly once: to a combinator, or to FutureOnCompletion().
+// The nodes complete on the Firebase threads (and the timeouts in FutureUpdate()), so the callbacks must be thread safe.
+
+typedef uint32_t HFuture;   // 0 if the pool was full. It then fails with ADMOB_ERROR_INTERNALERROR
+
+// Starts the next sdk call, and returns its future (e.g. the LoadAdLastResult() of the ad)
+typedef firebase::FutureBase (*FutureStepFn)(void* user_data);
+
+typedef void (*FutureCompletionFn)(int error, const char* error_message, void* user_data);
+
+void FutureInit(uint32_t capacity);
+
+// Call it after the sdk modules are terminated: a late sdk result still looks up its (stale) node in the pool
+void FutureFinalize();
+
+// Completes the nodes whose timeout has passed. Main thread. Returns at once if no timeout is pending.
+void FutureUpdate();
+
+// Takes over the completion callback of the sdk future (a future only has one)
+HFuture FutureFrom(const firebase::FutureBase& future);
+
+// Calls 'step' once 'future' succeeded, and completes with the future it returns. Fails with the error of 'future' otherwise.
+HFuture FutureThen(HFuture future, FutureStepFn step, void* user_data);
+
+// Succeeds when all the futures succeeded, or fails with the first error
+HFuture FutureWhenAll(const HFuture* futures, uint32_t count);
+
+// Succeeds with the first future that succeeds, or fails with the last error (e.g. the first fill of several loads).
+// The nodes of the other inputs are freed, and their late results dropped.
+HFuture FutureWhenAny(const HFuture* futures, uint32_t count);
+
+// Fails with ADMOB_ERROR_TIMEOUT if 'future' isn't complete after 'timeout' microseconds. Its node is then freed, and its
+// late result dropped.
+HFuture FutureTimeout(HFuture future, uint64_t timeout);
+
+// Calls 'fn' when the future completes (immediately if it already has), and frees it
+void FutureOnCompletion(HFuture future, FutureCompletionFn fn, void* user_data);
+
+}
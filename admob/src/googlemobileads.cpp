@@ -6,7 +6,7 @@
 #define DLIB_LOG_DOMAIN LIB_NAME
 #include <dmsdk/sdk.h>
 
-#if defined(DM_PLATFORM_IOS) || defined(DM_PLATFORM_ANDROID)
+#if defined(DM_PLATFORM_IOS) || defined(DM_PLATFORM_ANDROID) || defined(ADMOB_FAKE_BACKEND)
 
 // Firebase sdk ref:
 // https://firebase.google.com/docs/reference/cpp/namespace/firebase/admob
@@ -17,6 +17,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <dmsdk/dlib/atomic.h>
+#include <dmsdk/dlib/mutex.h>
+#include <dmsdk/dlib/thread.h>
+#include <dmsdk/dlib/time.h>
 
 #include "firebase/admob.h"
 #include "firebase/admob/banner_view.h"
@@ -26,9 +30,29 @@
 #include "firebase/admob/types.h"
 #include "firebase/app.h"
 #include "firebase/future.h"
+#include "firebase/util.h"
+#include "firebase_modules.h"
+#if defined(ADMOB_WITH_ANALYTICS)
+#include "firebase/analytics.h"
+#endif
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+#include "firebase/remote_config.h"
+#endif
 
+#include "ad_analytics.h"
+#include "ad_formats.h"
+#include "alloc.h"
+#include "config_snapshot.h"
 #include "enums.h"
+#include "fake_backend.h"
+#include "futures.h"
+#include "jni_env.h"
+#include "journal.h"
 #include "listeners.h"
+#include "profile.h"
+#include "stats.h"
+#include "tuning.h"
+#include "worker.h"
 
 namespace AdMobExtension
 {
@@ -39,6 +63,8 @@ void QueueRewardCommand(int id, int message, float reward, const char* reward_ty
 
 static void DeleteAdRequest(firebase::admob::AdRequest& adrequest);
 static void OnDestroyedCallback(const firebase::Future<void>& future, void* user_data);
+static void OnCompletionCallback(const firebase::Future<void>& future, void* user_data);
+static void OnLoadedCallback(const firebase::Future<void>& future, void* user_data);
 
 namespace
 {
@@ -51,29 +77,91 @@ struct LuaCallbackInfo
     int        m_Self;
 };
 
+const uint32_t ADMOB_MAX_INLINE_MESSAGE = 48;
+
+// Internal commands only update the ad state on the main thread, and aren't sent to Lua
+const int ADMOB_MESSAGE_INTERNAL = -1;
+
 struct MessageCommand
 {
+    AdMobExtension::PostCommandFn m_PreFn;      // A function to be called (on the main thread) before the command is processed
     AdMobExtension::PostCommandFn m_PostFn;     // A function to be called after the command was processed
-    char* m_FirebaseMessage;    // Firebase error message or reward type
+    char* m_FirebaseMessage;    // Firebase error message or reward type, if it doesn't fit in m_InlineMessage
+    char m_InlineMessage[ADMOB_MAX_INLINE_MESSAGE];
+    uint64_t m_Time;            // When the command was queued
+    uint32_t m_Generation;      // The AdMobAd::m_Generation of the sdk call, for its results (0 otherwise)
     int m_Id;
     int m_Message;
     int m_FirebaseResult;
     float m_Reward;
 };
 
+// The position and visibility of a banner type view
+struct AdMobViewState
+{
+    int     m_Position;     // AdMobPosition, or -1 for (m_X, m_Y)
+    int     m_X;
+    int     m_Y;
+    uint8_t m_HasPosition;
+    uint8_t m_HasVisible;
+    uint8_t m_Visible;
+};
+
+// The sdk calls that are watched for timeouts (see CheckTimeouts())
+enum AdMobWatchedCall
+{
+    ADMOB_CALL_NONE,
+    ADMOB_CALL_INITIALIZE,
+    ADMOB_CALL_LOAD,
+    ADMOB_CALL_DESTROY,
+};
+
+struct AdMobAd;
+
+// Starts (or stops, with ADMOB_CALL_NONE) the timeout of the ad's current sdk call
+void WatchCall(AdMobAd* ad, AdMobWatchedCall call);
+
+// Appends a destroyed ad to AdMobState::m_DestroyedAds, for its final delete on the next update
+void AddDestroyedAd(AdMobAd* ad);
+
+// Moves the initialized view of a banner type to AdMobState::m_RecycledViews, instead of destroying it
+bool RecycleView(AdMobAd* ad);
+
+// Deletes the sdk object of the ad. Returns true if it is a view being destroyed, and the ad is released later
+bool DeleteFormatObject(AdMobAd* ad);
+
+// Stops/restarts the refreshing of a banner type view
+void SetViewPaused(AdMobAd* ad, bool paused);
+
 struct AdMobAd
 {
     AdMobExtension::AdMobAdType m_Type;
     firebase::admob::AdRequest  m_AdRequest;
     LuaCallbackInfo             m_Callback;
     const char*                 m_AdUnit;
+    firebase::admob::AdParent   m_AdParent;         // Captured on the main thread for the worker thread
+    firebase::admob::AdSize     m_AdSize;           // For banner types
+    int                         m_StatsIndex;
     uint8_t                     m_Initialized;
-    uint8_t                     m_DelayedDelete;
+    uint8_t                     m_ViewInitialized;  // The view was initialized (banner types), and can be recycled
+    uint8_t                     m_Cancelled;        // Unloaded before the load finished (see CancelLoad())
+    uint8_t                     m_TunedAdUnit;      // 1 + the waterfall index of the ad unit from Remote Config, 0 if given to the load
+    uint8_t                     m_DelayedDelete;    // 0: none, 1: waiting for the destroy, 2: destroyed
+    uint8_t                     m_WatchedCall;      // AdMobWatchedCall
+    uint64_t                    m_WatchStart;
+    uint32_t                    m_Generation;       // Changed by each load and timeout, so that late results are dropped (see GetLoadId())
+    AdMobAd*                    m_NextDestroyed;    // Link in AdMobState::m_DestroyedAds (when m_DelayedDelete is 2)
+    AdMobViewState              m_ViewState;        // Set by the move/show/hide functions, applied once per frame
+    AdMobViewState              m_ViewApplied;      // The last state passed to the view
+    LuaCallbackInfo             m_Anchor;           // A vector3 or a function, resolved every frame (see UpdateAnchors())
+    int                         m_AnchorThreshold;  // How far (in pixels) the anchor moves before the view is moved
+    uint8_t                     m_AnchorIsFunction;
 
     // Set to non zero depending on ad type
     firebase::admob::BannerView*            m_BannerView;
     firebase::admob::InterstitialAd*        m_InterstitialAd;
     firebase::admob::NativeExpressAdView*   m_NativeExpressAdView;
+    AdMobExtension::RewardedVideoFormat*    m_RewardedVideo;    // Always 0, see AdFormatTraits<RewardedVideoFormat>
     // Listeners
     AdMobExtension::BannerViewListener*             m_BannerViewListener;
     AdMobExtension::InterstitialAdListener*         m_InterstitialAdListener;
@@ -82,73 +170,74 @@ struct AdMobAd
 
     AdMobAd()
     {
-        memset(this, 0, sizeof(*this));
+        memset((void*)this, 0, sizeof(*this));
         m_Callback.m_Callback = LUA_NOREF;
         m_Callback.m_Self = LUA_NOREF;
+        m_Anchor.m_Callback = LUA_NOREF;
+        m_Anchor.m_Self = LUA_NOREF;
+    }
+
+    // Passed to the sdk completion callbacks (as user data) and to the worker jobs, instead of the ad itself
+    int GetLoadId() const
+    {
+        return (int)(m_Generation * AdMobExtension::ADMOB_TYPE_MAX + m_Type);
+    }
+
+    // The worker jobs that refer to the ad
+    uint32_t GetWorkerGroup() const
+    {
+        return 1 + (uint32_t)m_Type;
+    }
+
+    // Stops/restarts the ad's refreshing while the app is in the background
+    void SetPaused(bool paused)
+    {
+        if( !m_Initialized || m_DelayedDelete )
+            return;
+        SetViewPaused(this, paused);
     }
 
     void Delete()
     {
         // Only because the Firebase SDK cannot delete the pointers correctly
-        if( m_DelayedDelete == 1 )
+        // The destroyed views are deleted from the destroyed list (see DeleteDestroyed())
+        if( m_DelayedDelete )
         {
             return;
         }
-        if( m_DelayedDelete == 2 )
-        {
-#if defined(DM_PLATFORM_ANDROID)
-            if( m_BannerView )
-                delete m_BannerView;
-
-            if( m_NativeExpressAdView )
-                delete m_NativeExpressAdView;
-#endif
-        }
-        else if( m_BannerView != 0 )
-        {
-            m_BannerView->SetListener(0);
-            delete m_BannerViewListener;
 
-            //delete m_BannerView; // The Firebase C++ examples says: "delete ptr", but it crashes on iOS
-            //m_BannerView = 0;
+        // The worker thread may still be initializing or loading this ad. The jobs of the other ads are not waited for
+        AdMobExtension::WorkerCancel(GetWorkerGroup());
 
-            m_DelayedDelete = 1;
-#if defined(DM_PLATFORM_ANDROID) // Due to the non working functionality on iOS
-            m_BannerView->Destroy();
-            m_BannerView->DestroyLastResult().OnCompletion(OnDestroyedCallback, this);
-#else
-            m_DelayedDelete = 2;
-            m_BannerView->Hide(); // Hack
-#endif
+        if( RecycleView(this) )
+        {
+            Release();
             return;
         }
-        else if( m_NativeExpressAdView != 0 )
-        {
-            //delete m_NativeExpressAdView; // The Firebase C++ examples says: "delete ptr", but it crashes on iOS
-            //m_NativeExpressAdView = 0;
-
-            m_NativeExpressAdView->SetListener(0);
-            delete m_NativeExpressAdViewListener;
 
-            m_DelayedDelete = 1;
-#if defined(DM_PLATFORM_ANDROID) // Due to the non working functionality on iOS
-            m_NativeExpressAdView->Destroy();
-            m_NativeExpressAdView->DestroyLastResult().OnCompletion(OnDestroyedCallback, this);
-#else
-            m_DelayedDelete = 2;
-            m_NativeExpressAdView->Hide(); // Hack
-#endif
+        if( DeleteFormatObject(this) )
             return;
-        }
-        else if( m_InterstitialAd != 0 )
-        {
-            m_InterstitialAd->SetListener(0);
-            delete m_InterstitialAd;
 
-            if( m_InterstitialAdListener )
-                delete m_InterstitialAdListener;
-        }
+        Release();
+    }
+
+    // The final delete of a banner type, once its view is destroyed
+    void DeleteDestroyed()
+    {
+        assert(m_DelayedDelete == 2);
+#if defined(DM_PLATFORM_ANDROID) || defined(ADMOB_FAKE_BACKEND)
+        if( m_BannerView )
+            delete m_BannerView;
 
+        if( m_NativeExpressAdView )
+            delete m_NativeExpressAdView;
+#endif
+        Release();
+    }
+
+private:
+    void Release()
+    {
         if( m_RewardedVideoListener )
         {
             firebase::admob::rewarded_video::SetListener(0);
@@ -157,31 +246,463 @@ struct AdMobAd
 
 
         if( m_AdUnit )
-            free((void*)m_AdUnit);
+            AdMobExtension::Free((void*)m_AdUnit);
         
         DeleteAdRequest(m_AdRequest);
 
-        memset(this, 0, sizeof(*this));
+        memset((void*)this, 0, sizeof(*this));
         m_Callback.m_Callback = LUA_NOREF;
         m_Callback.m_Self = LUA_NOREF;
+        m_Anchor.m_Callback = LUA_NOREF;
+        m_Anchor.m_Self = LUA_NOREF;
     }
 };
 
+// Where each format keeps its sdk object and listener in the ad
+template<typename T> struct AdFormatMembers;
+
+template<> struct AdFormatMembers<firebase::admob::BannerView>
+{
+    static firebase::admob::BannerView*& Object(AdMobAd* ad) { return ad->m_BannerView; }
+    static AdMobExtension::BannerViewListener*& Listener(AdMobAd* ad) { return ad->m_BannerViewListener; }
+};
+
+template<> struct AdFormatMembers<firebase::admob::NativeExpressAdView>
+{
+    static firebase::admob::NativeExpressAdView*& Object(AdMobAd* ad) { return ad->m_NativeExpressAdView; }
+    static AdMobExtension::NativeExpressAdViewListener*& Listener(AdMobAd* ad) { return ad->m_NativeExpressAdViewListener; }
+};
+
+template<> struct AdFormatMembers<firebase::admob::InterstitialAd>
+{
+    static firebase::admob::InterstitialAd*& Object(AdMobAd* ad) { return ad->m_InterstitialAd; }
+    static AdMobExtension::InterstitialAdListener*& Listener(AdMobAd* ad) { return ad->m_InterstitialAdListener; }
+};
+
+template<> struct AdFormatMembers<AdMobExtension::RewardedVideoFormat>
+{
+    static AdMobExtension::RewardedVideoFormat*& Object(AdMobAd* ad) { return ad->m_RewardedVideo; }
+    static AdMobExtension::RewardedVideoListener*& Listener(AdMobAd* ad) { return ad->m_RewardedVideoListener; }
+};
+
+// The functions of each ad format, instantiated from its AdFormatTraits (see RegisterAdFormats())
+struct AdFormatFunctions
+{
+    AdMobExtension::WorkerFn    m_InitializeFormatJob;  // Before the first ad of the format
+    void                        (*m_FinalizeFormat)();  // On the main thread, with no job of the format running
+    AdMobExtension::WorkerFn    m_InitializeAdJob;
+    AdMobExtension::WorkerFn    m_LoadAdJob;
+    void                        (*m_New)(AdMobAd* ad);
+    void                        (*m_SetListener)(AdMobAd* ad);
+    bool                        (*m_Delete)(AdMobAd* ad);
+    // Banner types only
+    void                        (*m_SetPaused)(AdMobAd* ad, bool paused);
+    uint32_t                    (*m_ApplyViewState)(AdMobAd* ad);
+};
+
 const int ADMOB_MAX_ADS = 4; // 4 types
+const int ADMOB_MAX_VIEW_POOL_SIZE = 16;
+const uint32_t ADMOB_FUTURE_POOL_SIZE = 32; // Nodes for the future continuations (see futures.h)
+
+enum AdMobInitState
+{
+    ADMOB_INIT_PENDING,
+    ADMOB_INIT_READY,
+    ADMOB_INIT_FAILED,
+};
+
+// The Firebase modules initialized at startup (AdMob is always the first one)
+enum AdMobModule
+{
+    ADMOB_MODULE_ADMOB,
+    ADMOB_MODULE_ANALYTICS,
+    ADMOB_MODULE_REMOTE_CONFIG,
+    ADMOB_MODULE_MAX,
+};
+
+static const char* ADMOB_MODULE_NAMES[ADMOB_MODULE_MAX] = { "admob", "analytics", "remote_config" };
+
+// The Firebase initialization, started on a separate thread at startup.
+// If the app exits before it's done, the task is leaked, since the sdk may still call back into it
+struct AdMobInitTask
+{
+    dmMutex::HMutex                 m_Mutex;        // Protects m_Done and m_Abandoned
+    dmThread::Thread                m_Thread;
+    char*                           m_AppId;
+    firebase::App*                  m_App;
+    firebase::ModuleInitializer*    m_Initializer;
+    int                             m_Result;       // firebase::InitResult of AdMob
+    uint64_t                        m_Start;
+    uint64_t                        m_Duration;     // Microseconds until all modules were initialized
+    bool                            m_Running;      // Until the thread is joined
+    bool                            m_Done;         // OnModulesInitialized() was called
+    bool                            m_Abandoned;    // The extension is finalized, the result is not queued
+
+    bool                            m_ModuleEnabled[ADMOB_MODULE_MAX];
+    bool                            m_ModuleReady[ADMOB_MODULE_MAX];
+    uint64_t                        m_ModuleDuration[ADMOB_MODULE_MAX];
+};
+
+// An initialized banner type view, kept hidden after its ad was unloaded, and reused by a load with the same ad unit and size
+struct AdMobRecycledView
+{
+    firebase::admob::BannerView*            m_BannerView;
+    firebase::admob::NativeExpressAdView*   m_NativeExpressAdView;
+    const char*                             m_AdUnit;
+    firebase::admob::AdSize                 m_AdSize;
+    AdMobExtension::AdMobAdType             m_Type;
+};
 
 struct AdMobState
 {
     AdMobAd         m_Ads[ADMOB_MAX_ADS];
     firebase::App*  m_App;
-    int             m_CoveringUIAd;         // Which ad went fullscreen?
+    int32_atomic_t  m_CoveringUIAd;         // Which ad went fullscreen? (set from the listener threads)
+
+    AdMobInitTask*  m_InitTask;
+    AdMobInitState  m_InitState;
+    uint64_t        m_StartTime;            // When AppInitializeExtension was called
+    bool            m_FirstFrame;
+    bool            m_IdleAllocationsLogged;    // Only the first idle frame that allocates is logged (they're all counted in the profile)
+    LuaCallbackInfo m_ReadyCallback;
 
-    dmArray<MessageCommand> m_CmdQueue;
+    // The ad formats are initialized on their first load, unless disabled in game.project
+    bool            m_FormatEnabled[ADMOB_MAX_ADS];
+    bool            m_FormatInitialized[ADMOB_MAX_ADS];
+
+    bool            m_Background;           // Between the deactivate and activate events
+
+    AdMobAd*        m_DestroyedAds;         // Ads whose views are destroyed, deleted on the next update
+
+    dmArray<AdMobRecycledView> m_RecycledViews; // The capacity is the pool size (admob.view_pool_size)
+
+    uint32_t        m_ChangedViews;         // A bit per ad type, for the views moved/shown/hidden during the frame
+    uint32_t        m_AnchoredViews;        // A bit per ad type, for the views with an anchor
+
+    uint32_t        m_Generation;           // The last AdMobAd::m_Generation
+    uint32_t        m_WatchedAds;           // A bit per ad type, for the ads with a watched sdk call
+    uint64_t        m_Timeouts[ADMOB_MAX_ADS];  // Per ad type, in microseconds (0 if disabled)
+    uint64_t        m_BackgroundStart;      // The timeouts don't run in the background
+    int             m_AnchorThreshold;      // The default threshold (admob.anchor_threshold)
+
+    uint32_t        m_Waterfall[ADMOB_MAX_ADS]; // Per ad type, the index of the next Remote Config ad unit to load
+    uint32_t        m_Shows[ADMOB_MAX_ADS];     // Per ad type, the shows during the session (for the show caps)
+    uint64_t        m_NextFetch;            // When the Remote Config values are fetched next (0 while fetching, or if disabled)
+    uint64_t        m_FetchInterval;        // In seconds, also the cache expiration of the fetch
+    uint32_t        m_FetchJitter;          // The random state of the jitter
+    bool            m_AnalyticsAdEvents;    // Log the ad events to Firebase Analytics (admob.analytics_ad_events)
+
+    AdMobExtension::BoundingBoxCache m_Bounds[ADMOB_MAX_ADS];   // Set by the banner type listeners
+
+    // Loads made before the sdk is ready, or while in the background (at most one per ad type), started when possible
+    int             m_PendingLoads[ADMOB_MAX_ADS];
+    uint32_t        m_NumPendingLoads;
+
+    dmMutex::HMutex         m_CmdQueueMutex;    // Protects m_CmdQueue
+    dmArray<MessageCommand> m_CmdQueue;         // Filled from the Firebase threads
+    dmArray<MessageCommand> m_CmdQueueFlush;    // Swapped with m_CmdQueue, and processed on the main thread
+    bool                    m_Flushing;
 };
 
 } // namespace
 
 ::AdMobState* g_AdMob = 0;
 
+namespace
+{
+
+AdFormatFunctions g_AdFormats[ADMOB_MAX_ADS];
+
+void WatchCall(AdMobAd* ad, AdMobWatchedCall call)
+{
+    ad->m_WatchedCall = call;
+    ad->m_WatchStart = dmTime::GetTime();
+    if( call != ADMOB_CALL_NONE )
+        g_AdMob->m_WatchedAds |= 1u << ad->m_Type;
+}
+
+void AddDestroyedAd(AdMobAd* ad)
+{
+    ad->m_NextDestroyed = g_AdMob->m_DestroyedAds;
+    g_AdMob->m_DestroyedAds = ad;
+}
+
+bool RecycleView(AdMobAd* ad)
+{
+    if( !ad->m_ViewInitialized || g_AdMob->m_RecycledViews.Full() )
+        return false;
+
+    AdMobRecycledView view;
+    view.m_BannerView = ad->m_BannerView;
+    view.m_NativeExpressAdView = ad->m_NativeExpressAdView;
+    view.m_AdUnit = ad->m_AdUnit;
+    view.m_AdSize = ad->m_AdSize;
+    view.m_Type = ad->m_Type;
+
+    if( ad->m_BannerView )
+    {
+        ad->m_BannerView->SetListener(0);
+        ad->m_BannerView->Hide();
+        ad->m_BannerView->Pause();
+        delete ad->m_BannerViewListener;
+    }
+    else if( ad->m_NativeExpressAdView )
+    {
+        ad->m_NativeExpressAdView->SetListener(0);
+        ad->m_NativeExpressAdView->Hide();
+        ad->m_NativeExpressAdView->Pause();
+        delete ad->m_NativeExpressAdViewListener;
+    }
+    else
+    {
+        return false;
+    }
+
+    g_AdMob->m_RecycledViews.Push(view);
+    ad->m_AdUnit = 0; // Owned by the recycled view
+    return true;
+}
+
+bool DeleteFormatObject(AdMobAd* ad)
+{
+    return g_AdFormats[ad->m_Type].m_Delete(ad);
+}
+
+void SetViewPaused(AdMobAd* ad, bool paused)
+{
+    if( g_AdFormats[ad->m_Type].m_SetPaused )
+        g_AdFormats[ad->m_Type].m_SetPaused(ad, paused);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Ad formats
+
+// Runs on the worker thread (if enabled), before the first InitializeAdJob of the format
+template<typename T> void InitializeFormatJob(int type)
+{
+    (void)type;
+    AdMobExtension::AdFormatTraits<T>::InitializeFormat();
+}
+
+// Runs on the worker thread (if enabled)
+template<typename T> void InitializeAdJob(int load_id)
+{
+    typedef AdMobExtension::AdFormatTraits<T> Traits;
+    AdMobAd* ad = &g_AdMob->m_Ads[Traits::TYPE];
+    Traits::Initialize(AdFormatMembers<T>::Object(ad), ad->m_AdParent, ad->m_AdUnit, ad->m_AdSize).OnCompletion(OnCompletionCallback, (void*)(uintptr_t)load_id);
+}
+
+// Runs on the worker thread (if enabled)
+template<typename T> void LoadAdJob(int load_id)
+{
+    typedef AdMobExtension::AdFormatTraits<T> Traits;
+    AdMobAd* ad = &g_AdMob->m_Ads[Traits::TYPE];
+    Traits::LoadAd(AdFormatMembers<T>::Object(ad), ad->m_AdUnit, ad->m_AdRequest).OnCompletion(OnLoadedCallback, (void*)(uintptr_t)load_id);
+}
+
+template<typename T> void NewFormatObject(AdMobAd* ad)
+{
+    AdFormatMembers<T>::Object(ad) = AdMobExtension::AdFormatTraits<T>::New();
+}
+
+template<typename T> void SetFormatListener(AdMobAd* ad)
+{
+    typedef AdMobExtension::AdFormatTraits<T> Traits;
+    typename Traits::Listener* listener = Traits::NewListener(&g_AdMob->m_CoveringUIAd, &g_AdMob->m_Bounds[Traits::TYPE], Traits::TYPE);
+    AdFormatMembers<T>::Listener(ad) = listener;
+    Traits::SetListener(AdFormatMembers<T>::Object(ad), listener);
+}
+
+template<typename T> void SetViewListener(AdMobAd* ad)
+{
+    typedef AdMobExtension::AdFormatTraits<T> Traits;
+    // The box of a recycled view may not change
+    AdMobExtension::SetBoundingBox(&g_AdMob->m_Bounds[Traits::TYPE], Traits::GetBoundingBox(AdFormatMembers<T>::Object(ad)));
+    SetFormatListener<T>(ad);
+}
+
+template<typename T> bool DeleteFormatAd(AdMobAd* ad)
+{
+    T* object = AdFormatMembers<T>::Object(ad);
+    if( object )
+    {
+        AdMobExtension::AdFormatTraits<T>::SetListener(object, 0);
+        delete object;
+        delete AdFormatMembers<T>::Listener(ad);
+    }
+    return false;
+}
+
+template<typename T> bool DeleteView(AdMobAd* ad)
+{
+    T* view = AdFormatMembers<T>::Object(ad);
+    if( !view )
+        return false;
+
+    view->SetListener(0);
+    delete AdFormatMembers<T>::Listener(ad);
+
+    //delete view; // The Firebase C++ examples says: "delete ptr", but it crashes on iOS
+
+    ad->m_DelayedDelete = 1;
+#if defined(DM_PLATFORM_ANDROID) || defined(ADMOB_FAKE_BACKEND) // Due to the non working functionality on iOS
+    view->Destroy();
+    view->DestroyLastResult().OnCompletion(OnDestroyedCallback, (void*)(uintptr_t)ad->GetLoadId());
+    WatchCall(ad, ADMOB_CALL_DESTROY);
+#else
+    ad->m_DelayedDelete = 2;
+    view->Hide(); // Hack
+    AddDestroyedAd(ad);
+#endif
+    return true;
+}
+
+template<typename T> void SetPaused(AdMobAd* ad, bool paused)
+{
+    T* view = AdFormatMembers<T>::Object(ad);
+    if( paused ) view->Pause();
+    else         view->Resume();
+}
+
+// Calls MoveTo/Show/Hide for what changed since the last frame. Returns the number of calls
+template<typename T> uint32_t ApplyViewState(AdMobAd* ad)
+{
+    if( !ad->m_Initialized || ad->m_DelayedDelete )
+        return 0;
+
+    T* view = AdFormatMembers<T>::Object(ad);
+    const AdMobViewState& state = ad->m_ViewState;
+    AdMobViewState& applied = ad->m_ViewApplied;
+    uint32_t calls = 0;
+
+    if( state.m_HasPosition && (!applied.m_HasPosition || state.m_Position != applied.m_Position ||
+                                (state.m_Position == -1 && (state.m_X != applied.m_X || state.m_Y != applied.m_Y))) )
+    {
+        if( state.m_Position == -1 ) view->MoveTo(state.m_X, state.m_Y);
+        else                         view->MoveTo((typename T::Position)state.m_Position);
+        ++calls;
+    }
+
+    if( state.m_HasVisible && (!applied.m_HasVisible || state.m_Visible != applied.m_Visible) )
+    {
+        if( state.m_Visible ) view->Show();
+        else                  view->Hide();
+        ++calls;
+    }
+
+    applied = state;
+    return calls;
+}
+
+template<typename T> AdFormatFunctions* RegisterAdFormat()
+{
+    typedef AdMobExtension::AdFormatTraits<T> Traits;
+    static_assert(Traits::TYPE >= 0 && Traits::TYPE < AdMobExtension::ADMOB_TYPE_MAX, "Invalid ad type");
+
+    AdFormatFunctions* functions = &g_AdFormats[Traits::TYPE];
+    memset(functions, 0, sizeof(*functions));
+    functions->m_InitializeFormatJob = InitializeFormatJob<T>;
+    functions->m_FinalizeFormat = AdMobExtension::AdFormatTraits<T>::FinalizeFormat;
+    functions->m_InitializeAdJob = InitializeAdJob<T>;
+    functions->m_LoadAdJob = LoadAdJob<T>;
+    functions->m_New = NewFormatObject<T>;
+    functions->m_SetListener = SetFormatListener<T>;
+    functions->m_Delete = DeleteFormatAd<T>;
+    return functions;
+}
+
+template<typename T> void RegisterViewFormat()
+{
+    static_assert(AdMobExtension::AdFormatTraits<T>::IS_VIEW, "Not a banner type");
+    AdFormatFunctions* functions = RegisterAdFormat<T>();
+    functions->m_SetListener = SetViewListener<T>;
+    functions->m_Delete = DeleteView<T>;
+    functions->m_SetPaused = SetPaused<T>;
+    functions->m_ApplyViewState = ApplyViewState<T>;
+}
+
+template<typename T> void RegisterFormat()
+{
+    static_assert(!AdMobExtension::AdFormatTraits<T>::IS_VIEW, "Use RegisterViewFormat()");
+    RegisterAdFormat<T>();
+}
+
+// A new format only needs its AdFormatTraits and AdFormatMembers, and a line here
+void RegisterAdFormats()
+{
+    RegisterViewFormat<firebase::admob::BannerView>();
+    RegisterFormat<firebase::admob::InterstitialAd>();
+    RegisterFormat<AdMobExtension::RewardedVideoFormat>();
+    RegisterViewFormat<firebase::admob::NativeExpressAdView>();
+}
+
+} // namespace
+
+static int GetAdId(void* user_data)
+{
+    return (int)((uintptr_t)user_data % AdMobExtension::ADMOB_TYPE_MAX);
+}
+
+static uint32_t GetAdGeneration(void* user_data)
+{
+    return (uint32_t)((uintptr_t)user_data / AdMobExtension::ADMOB_TYPE_MAX);
+}
+
+// Gives a recycled view with the same ad unit and size to the ad. It is already initialized, and only needs a LoadAd
+static bool ReuseRecycledView(::AdMobAd* ad)
+{
+    for( uint32_t i = 0; i < g_AdMob->m_RecycledViews.Size(); ++i )
+    {
+        AdMobRecycledView& view = g_AdMob->m_RecycledViews[i];
+        if( view.m_Type != ad->m_Type || view.m_AdSize.width != ad->m_AdSize.width || view.m_AdSize.height != ad->m_AdSize.height
+            || strcmp(view.m_AdUnit, ad->m_AdUnit) != 0 )
+            continue;
+
+        ad->m_BannerView = view.m_BannerView;
+        ad->m_NativeExpressAdView = view.m_NativeExpressAdView;
+        if( ad->m_BannerView )
+            ad->m_BannerView->Resume();
+        else
+            ad->m_NativeExpressAdView->Resume();
+        ad->m_ViewInitialized = 1;
+
+        AdMobExtension::Free((void*)view.m_AdUnit);
+        g_AdMob->m_RecycledViews.EraseSwap(i);
+        AdMobExtension::ProfileAddCount(AdMobExtension::PROFILE_COUNTER_RECYCLED_VIEWS, 1);
+        return true;
+    }
+    return false;
+}
+
+// The views can only be deleted on Android (see AdMobAd::Delete()), and they are left as is on iOS
+static void DeleteRecycledViews()
+{
+    for( uint32_t i = 0; i < g_AdMob->m_RecycledViews.Size(); ++i )
+    {
+        AdMobRecycledView& view = g_AdMob->m_RecycledViews[i];
+#if defined(DM_PLATFORM_ANDROID) || defined(ADMOB_FAKE_BACKEND)
+        if( view.m_BannerView )
+            delete view.m_BannerView;
+        if( view.m_NativeExpressAdView )
+            delete view.m_NativeExpressAdView;
+#endif
+        AdMobExtension::Free((void*)view.m_AdUnit);
+    }
+    g_AdMob->m_RecycledViews.SetSize(0);
+}
+
+static void DeleteDestroyedAds()
+{
+    ::AdMobAd* ad = g_AdMob->m_DestroyedAds;
+    g_AdMob->m_DestroyedAds = 0;
+    while( ad )
+    {
+        ::AdMobAd* next = ad->m_NextDestroyed;
+        ad->DeleteDestroyed();
+        ad = next;
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // LUA helpers
 
@@ -189,32 +710,32 @@ static void DeleteAdRequest(firebase::admob::AdRequest& adrequest)
 {
     for( uint32_t i = 0; i < adrequest.keyword_count; ++i)
     {
-        free((void*)adrequest.keywords[i]);
+        AdMobExtension::Free((void*)adrequest.keywords[i]);
     }
     if(adrequest.keywords != 0)
     {
-        free((void*)adrequest.keywords);
+        AdMobExtension::Free((void*)adrequest.keywords);
         adrequest.keywords = 0;
     }
 
     for( uint32_t i = 0; i < adrequest.test_device_id_count; ++i)
     {
-        free((void*)adrequest.test_device_ids[i]);
+        AdMobExtension::Free((void*)adrequest.test_device_ids[i]);
     }
     if(adrequest.test_device_ids != 0)
     {
-        free((void*)adrequest.test_device_ids);
+        AdMobExtension::Free((void*)adrequest.test_device_ids);
         adrequest.test_device_ids = 0;
     }
 
     for( uint32_t i = 0; i < adrequest.extras_count; ++i)
     {
-        free((void*)adrequest.extras[i].key);
-        free((void*)adrequest.extras[i].value);
+        AdMobExtension::Free((void*)adrequest.extras[i].key);
+        AdMobExtension::Free((void*)adrequest.extras[i].value);
     }
     if(adrequest.extras != 0)
     {
-        free((void*)adrequest.extras);
+        AdMobExtension::Free((void*)adrequest.extras);
         adrequest.extras = 0;
     }
     memset(&adrequest, 0, sizeof(adrequest));
@@ -249,7 +770,13 @@ static void UnregisterCallback(LuaCallbackInfo* cbk)
     }
 }
 
-static void InvokeCallback(LuaCallbackInfo* cbk, MessageCommand* cmd)
+static const char* GetCommandMessage(const MessageCommand* cmd)
+{
+    return cmd->m_FirebaseMessage ? cmd->m_FirebaseMessage : cmd->m_InlineMessage;
+}
+
+// The type, ad unit and box (of a layout message, may be 0) are passed in, since a replayed command has no live ad
+static void InvokeCallback(LuaCallbackInfo* cbk, MessageCommand* cmd, int type, const char* ad_unit, const firebase::admob::BoundingBox* box)
 {
     if(cbk->m_Callback == LUA_NOREF)
     {
@@ -267,25 +794,38 @@ static void InvokeCallback(LuaCallbackInfo* cbk, MessageCommand* cmd)
 
     dmScript::SetInstance(L);
 
-    ::AdMobAd* ad = &g_AdMob->m_Ads[cmd->m_Id];
-
     lua_newtable(L);
 
-        lua_pushnumber(L, ad->m_Type);
-        lua_setfield(L, -2, "type");
+        if( cmd->m_Message != AdMobExtension::ADMOB_MESSAGE_READY )
+        {
+            lua_pushnumber(L, type);
+            lua_setfield(L, -2, "type");
 
-        lua_pushstring(L, ad->m_AdUnit);
-        lua_setfield(L, -2, "ad_unit");
+            lua_pushstring(L, ad_unit);
+            lua_setfield(L, -2, "ad_unit");
+        }
 
         lua_pushnumber(L, cmd->m_Message);
         lua_setfield(L, -2, "message");
 
+        if( box )
+        {
+            lua_pushnumber(L, box->x);
+            lua_setfield(L, -2, "x");
+            lua_pushnumber(L, box->y);
+            lua_setfield(L, -2, "y");
+            lua_pushnumber(L, box->width);
+            lua_setfield(L, -2, "width");
+            lua_pushnumber(L, box->height);
+            lua_setfield(L, -2, "height");
+        }
+
         if( cmd->m_Message != AdMobExtension::ADMOB_MESSAGE_REWARD )
         {        
             lua_pushnumber(L, cmd->m_FirebaseResult);
             lua_setfield(L, -2, "result");
 
-            lua_pushstring(L, cmd->m_FirebaseMessage ? cmd->m_FirebaseMessage : "");
+            lua_pushstring(L, GetCommandMessage(cmd));
             lua_setfield(L, -2, "result_string");
         }
         else
@@ -293,7 +833,7 @@ static void InvokeCallback(LuaCallbackInfo* cbk, MessageCommand* cmd)
             lua_pushnumber(L, cmd->m_Reward);
             lua_setfield(L, -2, "reward");
 
-            lua_pushstring(L, cmd->m_FirebaseMessage ? cmd->m_FirebaseMessage : "");
+            lua_pushstring(L, GetCommandMessage(cmd));
             lua_setfield(L, -2, "reward_type");
         }
 
@@ -337,21 +877,29 @@ static void CheckTableStringList(lua_State* L, int index, char*** outlist, uint3
         return;
     }
     
-    int len = lua_objlen(L, index);
-    char** list = (char**)malloc(sizeof(char*) * len);
-
+    // The types are checked before anything is allocated, so an error doesn't leave a partial list behind
     lua_pushvalue(L, index); // push table
+    int len = 0;
     lua_pushnil(L);  // first key
-
-    int i = 0;
     while (lua_next(L, -2) != 0)
     {
-        const char* s = lua_tostring(L, -1);
-        if (!s) {
-            DM_LUA_ERROR("Wrong type for table attribute '%s'. Expected string, got %s", lua_tostring(L, -2), luaL_typename(L, -1) );
+        if (!lua_isstring(L, -1)) {
+            DM_LUA_ERROR("Wrong type for a list entry. Expected string, got %s", luaL_typename(L, -1));
             return;
         }
-        list[i++] = strdup(s);
+        ++len;
+        lua_pop(L, 1);
+    }
+
+    char** list = (char**)AdMobExtension::Malloc(sizeof(char*) * (len ? len : 1));
+    AdMobExtension::ProfileAddCount(AdMobExtension::PROFILE_COUNTER_AD_REQUEST_STRINGS, len);
+
+    lua_pushnil(L);  // first key
+
+    int i = 0;
+    while (lua_next(L, -2) != 0)
+    {
+        list[i++] = AdMobExtension::StrDup(lua_tostring(L, -1));
 
         // removes 'value'; keeps 'key' for next iteration
         lua_pop(L, 1);
@@ -374,10 +922,24 @@ static void CheckTableKeyValueList(lua_State* L, int index, firebase::admob::Key
         return;
     }
     
-    int len = lua_objlen(L, index);
-    firebase::admob::KeyValuePair* list = (firebase::admob::KeyValuePair*)malloc(sizeof(firebase::admob::KeyValuePair) * len);
-
+    // The pairs are { key = "value" }, which lua_objlen() doesn't count. The types are checked before anything is allocated
     lua_pushvalue(L, index); // push table
+    int len = 0;
+    lua_pushnil(L);  // first key
+    while (lua_next(L, -2) != 0)
+    {
+        // Not lua_tostring() on the key, it would convert a number key in place and break lua_next()
+        if (lua_type(L, -2) != LUA_TSTRING || !lua_isstring(L, -1)) {
+            DM_LUA_ERROR("Wrong type for extras. Expected string keys and values, got %s = %s", luaL_typename(L, -2), luaL_typename(L, -1));
+            return;
+        }
+        ++len;
+        lua_pop(L, 1);
+    }
+
+    firebase::admob::KeyValuePair* list = (firebase::admob::KeyValuePair*)AdMobExtension::Malloc(sizeof(firebase::admob::KeyValuePair) * (len ? len : 1));
+    AdMobExtension::ProfileAddCount(AdMobExtension::PROFILE_COUNTER_AD_REQUEST_STRINGS, len);
+
     lua_pushnil(L);  // first key
 
     int i = 0;
@@ -385,14 +947,8 @@ static void CheckTableKeyValueList(lua_State* L, int index, firebase::admob::Key
     {
         const char* k = lua_tostring(L, -2);
         const char* s = lua_tostring(L, -1);
-        if (!s) {
-            char msg[256];
-            snprintf(msg, sizeof(msg), "Wrong type for table attribute '%s'. Expected string, got %s", lua_tostring(L, -2), luaL_typename(L, -1) );
-            luaL_error(L, msg);
-            return;
-        }
-        list[i].key = strdup(k);
-        list[i].value = strdup(s);
+        list[i].key = AdMobExtension::StrDup(k);
+        list[i].value = AdMobExtension::StrDup(s);
         i++;
 
         // removes 'value'; keeps 'key' for next iteration
@@ -444,50 +1000,160 @@ static void SetupAdRequest(lua_State* L, int index, firebase::admob::AdRequest&
 namespace AdMobExtension
 {
 
-void QueueRewardCommand(int id, int message, float reward, const char* reward_type)
+// Short messages are stored in the command itself, to avoid allocating for each event
+static void SetCommandMessage(MessageCommand* cmd, const char* message)
 {
-    MessageCommand cmd;
-    cmd.m_Id = id;
-    cmd.m_Message = message;
-    cmd.m_FirebaseResult = 0;
-    cmd.m_FirebaseMessage = reward_type ? strdup(reward_type) : 0;
-    cmd.m_PostFn = 0;
-    cmd.m_Reward = reward;
+    cmd->m_FirebaseMessage = 0;
+    cmd->m_InlineMessage[0] = 0;
+    if( !message )
+        return;
+    size_t len = strlen(message);
+    if( len < ADMOB_MAX_INLINE_MESSAGE )
+        memcpy(cmd->m_InlineMessage, message, len + 1);
+    else
+        cmd->m_FirebaseMessage = StrDup(message);
+}
+
+static void PushCommand(const MessageCommand& cmd)
+{
+    ProfileAddCount(PROFILE_COUNTER_QUEUED_COMMANDS, 1);
 
-    // TODO: Add mutex here
+    DM_MUTEX_SCOPED_LOCK(g_AdMob->m_CmdQueueMutex);
     if(g_AdMob->m_CmdQueue.Full())
     {
+        CountAllocation();
         g_AdMob->m_CmdQueue.OffsetCapacity(8);
     }
     g_AdMob->m_CmdQueue.Push(cmd);
 }
 
-void QueueCommand(int id, int message, int firebase_result, const char* firebase_message, PostCommandFn fn)
+void QueueRewardCommand(int id, int message, float reward, const char* reward_type)
 {
     MessageCommand cmd;
     cmd.m_Id = id;
     cmd.m_Message = message;
-    cmd.m_FirebaseResult = firebase_result;
-    cmd.m_FirebaseMessage = firebase_message ? strdup(firebase_message) : 0;
-    cmd.m_PostFn = fn;
-    cmd.m_Reward = 0;
-
-    // TODO: Add mutex here
-    if(g_AdMob->m_CmdQueue.Full())
-    {
-        g_AdMob->m_CmdQueue.OffsetCapacity(8);
-    }
-    g_AdMob->m_CmdQueue.Push(cmd);
+    cmd.m_FirebaseResult = 0;
+    SetCommandMessage(&cmd, reward_type);
+    cmd.m_PreFn = 0;
+    cmd.m_PostFn = 0;
+    cmd.m_Generation = 0;
+    cmd.m_Reward = reward;
+    cmd.m_Time = dmTime::GetTime();
+    PushCommand(cmd);
+}
+
+static void QueueCommand(int id, uint32_t generation, int message, int firebase_result, const char* firebase_message, PostCommandFn pre_fn, PostCommandFn post_fn)
+{
+    MessageCommand cmd;
+    cmd.m_Id = id;
+    cmd.m_Generation = generation;
+    cmd.m_Message = message;
+    cmd.m_FirebaseResult = firebase_result;
+    SetCommandMessage(&cmd, firebase_message);
+    cmd.m_PreFn = pre_fn;
+    cmd.m_PostFn = post_fn;
+    cmd.m_Reward = 0;
+    cmd.m_Time = dmTime::GetTime();
+    PushCommand(cmd);
+}
+
+// The Firebase threads never touch the ads directly, they hand the results over to the main thread
+static void QueueStateCommand(int id, int message, int firebase_result, const char* firebase_message, PostCommandFn pre_fn, PostCommandFn post_fn)
+{
+    QueueCommand(id, 0, message, firebase_result, firebase_message, pre_fn, post_fn);
 }
 
-static void FlushCommandQueue()
+// For the result of an sdk call. It is dropped if the ad was unloaded, or timed out, since the call was made
+static void QueueLoadCommand(void* user_data, int message, int firebase_result, const char* firebase_message, PostCommandFn pre_fn, PostCommandFn post_fn)
 {
-    for(uint32_t i = 0; i != g_AdMob->m_CmdQueue.Size(); ++i)
+    QueueCommand(GetAdId(user_data), GetAdGeneration(user_data), message, firebase_result, firebase_message, pre_fn, post_fn);
+}
+
+void QueueCommand(int id, int message, int firebase_result, const char* firebase_message, PostCommandFn fn)
+{
+    QueueStateCommand(id, message, firebase_result, firebase_message, 0, fn);
+}
+
+// A fill restarts the waterfall of the ad type, a no fill moves on to the next ad unit
+static void UpdateWaterfall(::AdMobAd* ad, int message, int firebase_result)
+{
+    if( message == ADMOB_MESSAGE_LOADED )
+        g_AdMob->m_Waterfall[ad->m_Type] = 0;
+    else if( message == ADMOB_MESSAGE_FAILED_TO_LOAD && (firebase_result == ADMOB_ERROR_NOFILL || firebase_result == ADMOB_ERROR_TIMEOUT) )
+        g_AdMob->m_Waterfall[ad->m_Type] = ad->m_TunedAdUnit;
+}
+
+// Delivers the queued commands to the ads' callbacks (and to the journal).
+// Returns the number of delivered commands
+static uint32_t FlushCommandQueue()
+{
+    // A Lua callback may flush again, those commands are delivered next frame
+    if( g_AdMob->m_Flushing )
+        return 0;
+
     {
-        MessageCommand* cmd = &g_AdMob->m_CmdQueue[i];
+        DM_MUTEX_SCOPED_LOCK(g_AdMob->m_CmdQueueMutex);
+        if( g_AdMob->m_CmdQueue.Empty() )
+            return 0;
+        // The Firebase threads may keep queueing while we process the commands
+        g_AdMob->m_CmdQueue.Swap(g_AdMob->m_CmdQueueFlush);
+    }
+
+    g_AdMob->m_Flushing = true;
+    uint32_t count = g_AdMob->m_CmdQueueFlush.Size();
+    for(uint32_t i = 0; i != count; ++i)
+    {
+        MessageCommand* cmd = &g_AdMob->m_CmdQueueFlush[i];
         ::AdMobAd& ad = g_AdMob->m_Ads[cmd->m_Id];
 
-        InvokeCallback(&ad.m_Callback, cmd);
+        if( cmd->m_Generation != 0 )
+        {
+            if( cmd->m_Generation != ad.m_Generation )
+            {
+                ProfileAddCount(PROFILE_COUNTER_DROPPED_COMMANDS, 1);
+                if( cmd->m_FirebaseMessage )
+                    Free(cmd->m_FirebaseMessage);
+                cmd->m_FirebaseMessage = 0;
+                continue;
+            }
+            if( cmd->m_Message == ADMOB_MESSAGE_LOADED )
+                StatsAddFill(ad.m_StatsIndex);
+            else if( cmd->m_Message == ADMOB_MESSAGE_FAILED_TO_LOAD )
+                StatsAddError(ad.m_StatsIndex, cmd->m_FirebaseResult);
+            if( ad.m_TunedAdUnit )
+                UpdateWaterfall(&ad, cmd->m_Message, cmd->m_FirebaseResult);
+        }
+
+        if( cmd->m_PreFn )
+        {
+            cmd->m_PreFn(cmd->m_Id);
+        }
+
+        if( cmd->m_Message != ADMOB_MESSAGE_INTERNAL )
+        {
+            ProfileAddCount(PROFILE_COUNTER_DELIVERED_COMMANDS, 1);
+            if( cmd->m_Message >= ADMOB_MESSAGE_LOADED && cmd->m_Message <= ADMOB_MESSAGE_UNLOADED )
+                ProfileAddCount((ProfileCounter)(PROFILE_COUNTER_MESSAGE_LOADED + cmd->m_Message), 1);
+
+            firebase::admob::BoundingBox box;
+            memset((void*)&box, 0, sizeof(box));
+            bool has_box = cmd->m_Message == ADMOB_MESSAGE_LAYOUT && GetBoundingBox(&g_AdMob->m_Bounds[cmd->m_Id], &box);
+            int journal_box[4] = { 0, 0, 0, 0 };
+            if( has_box )
+            {
+                journal_box[0] = box.x;
+                journal_box[1] = box.y;
+                journal_box[2] = box.width;
+                journal_box[3] = box.height;
+            }
+
+            JournalAppend(cmd->m_Time, cmd->m_Id, ad.m_Type, ad.m_AdUnit, cmd->m_Message, cmd->m_FirebaseResult, GetCommandMessage(cmd), cmd->m_Reward,
+                            has_box ? journal_box : 0, cmd->m_PostFn != 0);
+            AnalyticsLogAdEvent(cmd->m_Id, cmd->m_Message, ad.m_AdUnit, cmd->m_FirebaseResult, cmd->m_Reward, GetCommandMessage(cmd));
+
+            LuaCallbackInfo* callback = cmd->m_Message == ADMOB_MESSAGE_READY ? &g_AdMob->m_ReadyCallback : &ad.m_Callback;
+            InvokeCallback(callback, cmd, ad.m_Type, ad.m_AdUnit, has_box ? &box : 0);
+        }
 
         if( cmd->m_PostFn )
         {
@@ -495,10 +1161,12 @@ static void FlushCommandQueue()
         }
 
         if( cmd->m_FirebaseMessage )
-            free(cmd->m_FirebaseMessage);
+            Free(cmd->m_FirebaseMessage);
         cmd->m_FirebaseMessage = 0;
     }
-    g_AdMob->m_CmdQueue.SetSize(0);
+    g_AdMob->m_CmdQueueFlush.SetSize(0);
+    g_AdMob->m_Flushing = false;
+    return count;
 }
 
 } // AdMobExtension
@@ -509,102 +1177,363 @@ static void DeleteCommandCallback(int type)
 {
     ::AdMobAd* ad = &g_AdMob->m_Ads[type];
     UnregisterCallback(&ad->m_Callback);
+    UnregisterCallback(&ad->m_Anchor);
+    g_AdMob->m_AnchoredViews &= ~(1u << type);
     ad->Delete();
 }
 
-static void OnDestroyedCallback(const firebase::Future<void>& future, void* user_data)
+// The completion callbacks below are called on the Firebase threads.
+// They only publish the results, and the ad state is updated on the main thread (the *CommandCallback functions)
+
+static void DestroyedCommandCallback(int type)
 {
-    ::AdMobAd* ad = (AdMobAd*)user_data;
+    ::AdMobAd* ad = &g_AdMob->m_Ads[type];
+    if( ad->m_DelayedDelete == 1 )
+    {
+        WatchCall(ad, ADMOB_CALL_NONE);
+        ad->m_DelayedDelete = 2;
+        AddDestroyedAd(ad);
+    }
+}
 
-    switch(ad->m_Type)
+static void OnDestroyedCallback(const firebase::Future<void>& future, void* user_data)
+{
+    (void)future;
+    int type = GetAdId(user_data);
+    switch(type)
     {
     case AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS:
     case AdMobExtension::ADMOB_TYPE_BANNER:
-        ad->m_DelayedDelete = 2;
+        AdMobExtension::QueueLoadCommand(user_data, ADMOB_MESSAGE_INTERNAL, 0, 0, DestroyedCommandCallback, 0);
         break;
     default:
         return;
     }
 }
 
+// Sets the listener before the ADMOB_MESSAGE_LOADED is sent to Lua
+static void LoadedCommandCallback(int type)
+{
+    ::AdMobAd* ad = &g_AdMob->m_Ads[type];
+    if( ad->m_AdUnit == 0 || ad->m_DelayedDelete ) // Unloaded before the load finished
+        return;
+    WatchCall(ad, ADMOB_CALL_NONE);
+
+    g_AdFormats[type].m_SetListener(ad);
+    ad->m_Initialized = 1;
+
+    if( g_AdMob->m_Background )
+        ad->SetPaused(true);
+}
+
+// The fills and errors are counted when the commands are delivered, see FlushCommandQueue()
 static void OnLoadedCallback(const firebase::Future<void>& future, void* user_data)
 {
-    ::AdMobAd* ad = (AdMobAd*)user_data;
     if (future.error() != firebase::admob::kAdMobErrorNone)
     {
-        QueueCommand(ad->m_Type, AdMobExtension::ADMOB_MESSAGE_FAILED_TO_LOAD, future.error(), future.error_message(), DeleteCommandCallback);
+        AdMobExtension::QueueLoadCommand(user_data, AdMobExtension::ADMOB_MESSAGE_FAILED_TO_LOAD, future.error(), future.error_message(), 0, DeleteCommandCallback);
         return;
     }
 
-    ad->m_Initialized = 1;
-    switch(ad->m_Type)
+    AdMobExtension::QueueLoadCommand(user_data, AdMobExtension::ADMOB_MESSAGE_LOADED, future.error(), future.error_message(), LoadedCommandCallback, 0);
+}
+
+// The ad is initialized, start loading it
+static void LoadAdCommandCallback(int type)
+{
+    ::AdMobAd* ad = &g_AdMob->m_Ads[type];
+    if( ad->m_AdUnit == 0 || ad->m_DelayedDelete ) // Unloaded before the initialization finished
+        return;
+    ad->m_ViewInitialized = ad->m_BannerView || ad->m_NativeExpressAdView;
+    AdMobExtension::WorkerRun(g_AdFormats[type].m_LoadAdJob, ad->GetLoadId(), ad->GetWorkerGroup());
+    WatchCall(ad, ADMOB_CALL_LOAD);
+}
+
+// The initialization failed. The format is finalized, and initialized again by the next load
+// (the rewarded video initialization is the format initialization, see AdFormatTraits<RewardedVideoFormat>)
+static void InitializeFailedCommandCallback(int type)
+{
+    DeleteCommandCallback(type);
+    if( g_AdMob->m_FormatInitialized[type] )
     {
-    case AdMobExtension::ADMOB_TYPE_BANNER:
-        ad->m_BannerViewListener = new AdMobExtension::BannerViewListener(&g_AdMob->m_CoveringUIAd, ad->m_Type);
-        ad->m_BannerView->SetListener(ad->m_BannerViewListener);
-        break;
-    case AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS:
-        ad->m_NativeExpressAdViewListener = new AdMobExtension::NativeExpressAdViewListener(&g_AdMob->m_CoveringUIAd, ad->m_Type);
-        ad->m_NativeExpressAdView->SetListener(ad->m_NativeExpressAdViewListener);
-        break;
-    case AdMobExtension::ADMOB_TYPE_INTERSTITIAL:
-        ad->m_InterstitialAdListener = new AdMobExtension::InterstitialAdListener(&g_AdMob->m_CoveringUIAd, ad->m_Type);
-        ad->m_InterstitialAd->SetListener(ad->m_InterstitialAdListener);
-        break;
-    case AdMobExtension::ADMOB_TYPE_REWARDEDVIDEO:
-        ad->m_RewardedVideoListener = new AdMobExtension::RewardedVideoListener(&g_AdMob->m_CoveringUIAd, ad->m_Type);
-        firebase::admob::rewarded_video::SetListener(ad->m_RewardedVideoListener);
-        break;
-    default:
+        g_AdFormats[type].m_FinalizeFormat();
+        g_AdMob->m_FormatInitialized[type] = false;
+    }
+}
+
+static void OnCompletionCallback(const firebase::Future<void>& future, void* user_data)
+{
+    if (future.error() != firebase::admob::kAdMobErrorNone)
+    {
+        AdMobExtension::QueueLoadCommand(user_data, AdMobExtension::ADMOB_MESSAGE_FAILED_TO_LOAD, future.error(), future.error_message(), 0, InitializeFailedCommandCallback);
         return;
     }
 
-    QueueCommand(ad->m_Type, AdMobExtension::ADMOB_MESSAGE_LOADED, future.error(), future.error_message(), 0);
+    AdMobExtension::QueueLoadCommand(user_data, ADMOB_MESSAGE_INTERNAL, 0, 0, LoadAdCommandCallback, 0);
 }
 
-static void OnCompletionCallback(const firebase::Future<void>& future, void* user_data)
+static bool IsLoadPending(int type)
 {
-    ::AdMobAd* ad = (AdMobAd*)user_data;
+    for( uint32_t i = 0; i < g_AdMob->m_NumPendingLoads; ++i )
+    {
+        if( g_AdMob->m_PendingLoads[i] == type )
+            return true;
+    }
+    return false;
+}
 
-    if (future.error() != firebase::admob::kAdMobErrorNone)
+// Creates the ad and starts initializing it. Until the sdk is ready, the load is kept in the pending list
+static void StartLoad(::AdMobAd* ad)
+{
+    ad->m_Generation = ++g_AdMob->m_Generation;
+    if( g_AdMob->m_InitState == ADMOB_INIT_PENDING || g_AdMob->m_Background )
     {
-        QueueCommand(ad->m_Type, AdMobExtension::ADMOB_MESSAGE_FAILED_TO_LOAD, future.error(), future.error_message(), DeleteCommandCallback);
+        assert(g_AdMob->m_NumPendingLoads < ADMOB_MAX_ADS);
+        g_AdMob->m_PendingLoads[g_AdMob->m_NumPendingLoads++] = ad->m_Type;
+        return;
+    }
+    if( g_AdMob->m_InitState == ADMOB_INIT_FAILED )
+    {
+        AdMobExtension::QueueLoadCommand((void*)(uintptr_t)ad->GetLoadId(), AdMobExtension::ADMOB_MESSAGE_FAILED_TO_LOAD, AdMobExtension::ADMOB_ERROR_UNINITIALIZED, "AdMob failed to initialize", 0, DeleteCommandCallback);
         return;
     }
 
-    switch(ad->m_Type)
+    if( !g_AdMob->m_FormatInitialized[ad->m_Type] )
     {
-    case AdMobExtension::ADMOB_TYPE_BANNER:
-            ad->m_BannerView->LoadAd(ad->m_AdRequest);
-            ad->m_BannerView->LoadAdLastResult().OnCompletion(OnLoadedCallback, ad);
-            return;
+        g_AdMob->m_FormatInitialized[ad->m_Type] = true;
+        AdMobExtension::WorkerRun(g_AdFormats[ad->m_Type].m_InitializeFormatJob, ad->m_Type, AdMobExtension::WORKER_GROUP_NONE); // Not cancelled with the ad
+    }
 
-    case AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS:
-            ad->m_NativeExpressAdView->LoadAd(ad->m_AdRequest);
-            ad->m_NativeExpressAdView->LoadAdLastResult().OnCompletion(OnLoadedCallback, ad);
-            return;
+    if( ReuseRecycledView(ad) )
+    {
+        AdMobExtension::WorkerRun(g_AdFormats[ad->m_Type].m_LoadAdJob, ad->GetLoadId(), ad->GetWorkerGroup());
+        WatchCall(ad, ADMOB_CALL_LOAD);
+        return;
+    }
 
-    case AdMobExtension::ADMOB_TYPE_INTERSTITIAL:
-            ad->m_InterstitialAd->LoadAd(ad->m_AdRequest);
-            ad->m_InterstitialAd->LoadAdLastResult().OnCompletion(OnLoadedCallback, ad);
-            return;
+    g_AdFormats[ad->m_Type].m_New(ad);
+    AdMobExtension::WorkerRun(g_AdFormats[ad->m_Type].m_InitializeAdJob, ad->GetLoadId(), ad->GetWorkerGroup());
+    WatchCall(ad, ADMOB_CALL_INITIALIZE);
+}
 
-    case AdMobExtension::ADMOB_TYPE_REWARDEDVIDEO:
-            firebase::admob::rewarded_video::LoadAd(ad->m_AdUnit, ad->m_AdRequest);
-            firebase::admob::rewarded_video::LoadAdLastResult().OnCompletion(OnLoadedCallback, ad);
-            return;
-    default:
-        break;
+static void StartPendingLoads()
+{
+    int pending[ADMOB_MAX_ADS];
+    uint32_t count = g_AdMob->m_NumPendingLoads;
+    memcpy(pending, g_AdMob->m_PendingLoads, sizeof(pending));
+    g_AdMob->m_NumPendingLoads = 0;
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        StartLoad(&g_AdMob->m_Ads[pending[i]]);
+    }
+}
+
+// Gives up on the ad's current sdk call. The result, if it ever comes, is dropped (see FlushCommandQueue)
+static void TimeoutAd(::AdMobAd* ad)
+{
+    AdMobWatchedCall call = (AdMobWatchedCall)ad->m_WatchedCall;
+    WatchCall(ad, ADMOB_CALL_NONE);
+    ad->m_Generation = ++g_AdMob->m_Generation;
+    AdMobExtension::ProfileAddCount(AdMobExtension::PROFILE_COUNTER_TIMEOUTS, 1);
+
+    if( call == ADMOB_CALL_DESTROY )
+    {
+        // The sdk still owns the view, so it is leaked
+        dmLogWarning("AdMob: the destroy of ad type %d timed out", ad->m_Type);
+        ad->m_BannerView = 0;
+        ad->m_NativeExpressAdView = 0;
+        ad->m_DelayedDelete = 2;
+        AddDestroyedAd(ad);
+        return;
+    }
+
+    dmLogWarning("AdMob: the %s of ad type %d timed out", call == ADMOB_CALL_INITIALIZE ? "initialize" : "load", ad->m_Type);
+    ad->m_ViewInitialized = 0; // The view may still be loading, so it isn't recycled
+    AdMobExtension::QueueLoadCommand((void*)(uintptr_t)ad->GetLoadId(), AdMobExtension::ADMOB_MESSAGE_FAILED_TO_LOAD, AdMobExtension::ADMOB_ERROR_TIMEOUT, "The ad timed out", 0, DeleteCommandCallback);
+}
+
+// The Futures of the sdk calls may never complete (e.g. no network), which would block the ad slot forever
+static void CheckTimeouts()
+{
+    uint64_t time = dmTime::GetTime();
+    for( uint32_t i = 0; i < ADMOB_MAX_ADS; ++i )
+    {
+        if( !(g_AdMob->m_WatchedAds & (1u << i)) )
+            continue;
+
+        ::AdMobAd* ad = &g_AdMob->m_Ads[i];
+        if( ad->m_WatchedCall == ADMOB_CALL_NONE )
+        {
+            g_AdMob->m_WatchedAds &= ~(1u << i);
+            continue;
+        }
+
+        uint64_t timeout = g_AdMob->m_Timeouts[i];
+        if( timeout && time - ad->m_WatchStart > timeout )
+            TimeoutAd(ad);
+    }
+}
+
+// Pauses or resumes all the live ads, and holds back the new loads while in the background
+static void SetBackground(bool background)
+{
+    if( g_AdMob->m_Background == background )
+        return;
+    g_AdMob->m_Background = background;
+
+    // The timeouts are paused while in the background
+    if( background )
+    {
+        g_AdMob->m_BackgroundStart = dmTime::GetTime();
+    }
+    else
+    {
+        uint64_t duration = dmTime::GetTime() - g_AdMob->m_BackgroundStart;
+        for( uint32_t i = 0; i < ADMOB_MAX_ADS; ++i )
+        {
+            g_AdMob->m_Ads[i].m_WatchStart += duration;
+        }
+    }
+
+    if( g_AdMob->m_InitState != ADMOB_INIT_READY )
+        return;
+
+    for( uint32_t i = 0; i < ADMOB_MAX_ADS; ++i )
+    {
+        g_AdMob->m_Ads[i].SetPaused(background);
+    }
+
+    if( g_AdMob->m_FormatInitialized[AdMobExtension::ADMOB_TYPE_REWARDEDVIDEO] )
+    {
+        if( background ) firebase::admob::rewarded_video::Pause();
+        else             firebase::admob::rewarded_video::Resume();
+    }
+
+    if( !background )
+        StartPendingLoads();
+}
+
+// The view calls cross into Java/ObjC, so the move/show/hide functions only record the last request of the frame
+static void SetViewPosition(::AdMobAd* ad, int position, int x, int y)
+{
+    ad->m_ViewState.m_Position = position;
+    ad->m_ViewState.m_X = x;
+    ad->m_ViewState.m_Y = y;
+    ad->m_ViewState.m_HasPosition = 1;
+    g_AdMob->m_ChangedViews |= 1u << ad->m_Type;
+}
+
+static void SetViewVisible(::AdMobAd* ad, bool visible)
+{
+    ad->m_ViewState.m_Visible = visible ? 1 : 0;
+    ad->m_ViewState.m_HasVisible = 1;
+    g_AdMob->m_ChangedViews |= 1u << ad->m_Type;
+}
+
+// Gets the position of the anchor, in the same coordinates as move_banner(x, y)
+static bool ResolveAnchor(::AdMobAd* ad, int* x, int* y)
+{
+    LuaCallbackInfo* anchor = &ad->m_Anchor;
+    lua_State* L = anchor->m_L;
+    DM_LUA_STACK_CHECK(L, 0);
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, anchor->m_Callback);
+    if( !ad->m_AnchorIsFunction )
+    {
+        Vectormath::Aos::Vector3* v = dmScript::ToVector3(L, -1);
+        *x = (int)v->getX();
+        *y = (int)v->getY();
+        lua_pop(L, 1);
+        return true;
+    }
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, anchor->m_Self);
+    lua_pushvalue(L, -1);
+    dmScript::SetInstance(L);
+
+    if( lua_pcall(L, 1, 2, 0) != 0 )
+    {
+        dmLogError("Error running anchor function: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return false;
     }
+
+    bool ok = true;
+    if( dmScript::IsVector3(L, -2) )
+    {
+        Vectormath::Aos::Vector3* v = dmScript::ToVector3(L, -2);
+        *x = (int)v->getX();
+        *y = (int)v->getY();
+    }
+    else if( lua_isnumber(L, -2) && lua_isnumber(L, -1) )
+    {
+        *x = (int)lua_tonumber(L, -2);
+        *y = (int)lua_tonumber(L, -1);
+    }
+    else
+    {
+        dmLogError("The anchor function must return a vector3 or x, y");
+        ok = false;
+    }
+    lua_pop(L, 2);
+    return ok;
 }
 
+// Moves the anchored views whose anchor moved more than the threshold (the move is then applied with the other view calls)
+static void UpdateAnchors()
+{
+    for( uint32_t i = 0; i < ADMOB_MAX_ADS; ++i )
+    {
+        if( !(g_AdMob->m_AnchoredViews & (1u << i)) )
+            continue;
+
+        ::AdMobAd* ad = &g_AdMob->m_Ads[i];
+        if( !ad->m_Initialized || ad->m_DelayedDelete )
+            continue;
 
+        int x, y;
+        if( !ResolveAnchor(ad, &x, &y) )
+        {
+            UnregisterCallback(&ad->m_Anchor); // Don't log the same error every frame
+            g_AdMob->m_AnchoredViews &= ~(1u << i);
+            continue;
+        }
 
+        const AdMobViewState& state = ad->m_ViewState;
+        if( state.m_HasPosition && state.m_Position == -1 &&
+            abs(x - state.m_X) <= ad->m_AnchorThreshold && abs(y - state.m_Y) <= ad->m_AnchorThreshold )
+            continue;
+
+        SetViewPosition(ad, -1, x, y);
+    }
+}
+
+static void ApplyViewStates()
+{
+    uint32_t calls = 0;
+    for( uint32_t i = 0; i < ADMOB_MAX_ADS; ++i )
+    {
+        if( (g_AdMob->m_ChangedViews & (1u << i)) && g_AdFormats[i].m_ApplyViewState )
+            calls += g_AdFormats[i].m_ApplyViewState(&g_AdMob->m_Ads[i]);
+    }
+    g_AdMob->m_ChangedViews = 0;
+
+    if( calls )
+    {
+        AdMobExtension::ProfileAddCount(AdMobExtension::PROFILE_COUNTER_VIEW_CALLS, calls);
+        AdMobExtension::ProfileAddCount(AdMobExtension::PROFILE_COUNTER_VIEW_CALL_FRAMES, 1);
+    }
+}
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Glue functions
 
-#if defined(DM_PLATFORM_IOS)
+#if defined(ADMOB_FAKE_BACKEND)
+static inline firebase::admob::AdParent GetAdParent()
+{
+    return 0;
+}
+#elif defined(DM_PLATFORM_IOS)
 static inline firebase::admob::AdParent GetAdParent()
 {
     return (firebase::admob::AdParent)(id)dmGraphics::GetNativeiOSUIView();
@@ -614,238 +1543,291 @@ static inline firebase::admob::AdParent GetAdParent()
 {
     return (firebase::admob::AdParent)(jobject)dmGraphics::GetNativeAndroidActivity();
 }
-static JNIEnv* GetJNIEnv()
-{
-    JNIEnv* env = 0;
-    dmGraphics::GetNativeAndroidJavaVM()->AttachCurrentThread(&env, NULL);
-    return env;
-}
 #endif
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Lua implementation
 
-////////////////////////////////////////////////////////
-// BANNER
+// An ad that is still initializing or loading is cancelled: its results are dropped, and its sdk objects
+// are deleted (or recycled) after the ADMOB_MESSAGE_UNLOADED, like a loaded ad
+static void CancelLoad(::AdMobAd* ad)
+{
+    for( uint32_t i = 0; i < g_AdMob->m_NumPendingLoads; ++i )
+    {
+        if( g_AdMob->m_PendingLoads[i] == ad->m_Type )
+        {
+            g_AdMob->m_PendingLoads[i] = g_AdMob->m_PendingLoads[--g_AdMob->m_NumPendingLoads];
+            break;
+        }
+    }
 
-static int BannerLoad(lua_State* L)
+    if( ad->m_WatchedCall == ADMOB_CALL_LOAD )
+        ad->m_ViewInitialized = 0; // The view is still loading, so it isn't recycled
+    WatchCall(ad, ADMOB_CALL_NONE);
+    ad->m_Generation = ++g_AdMob->m_Generation;
+    ad->m_Cancelled = 1;
+    AdMobExtension::ProfileAddCount(AdMobExtension::PROFILE_COUNTER_CANCELLED_LOADS, 1);
+}
+
+static int UnloadAd(lua_State* L, ::AdMobAd* ad)
+{
+    if( ad->m_Initialized == 0 )
+    {
+        if( ad->m_AdUnit == 0 || ad->m_Cancelled || ad->m_DelayedDelete )
+            return luaL_error(L, "Ad is not loaded!");
+        CancelLoad(ad);
+    }
+    // The slot's own type: m_Type is only set once a load got through its argument checks
+    int type = (int)(ad - g_AdMob->m_Ads);
+    QueueCommand(type, AdMobExtension::ADMOB_MESSAGE_UNLOADED, 0, 0, DeleteCommandCallback);
+    return 0;
+}
+
+// admob.load_<format>(ad_unit, [request], [callback])
+template<typename T> static int LoadFormat(lua_State* L)
 {
     DM_LUA_STACK_CHECK(L, 0);
 
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER];
+    typedef AdMobExtension::AdFormatTraits<T> Traits;
+    ::AdMobAd* ad = &g_AdMob->m_Ads[Traits::TYPE];
     if(ad->m_Initialized != 0)
-        return luaL_error(L, "Ad is still loaded! Call admob.banner_unload() first");
+        return luaL_error(L, "Ad is still loaded! Call admob.unload_%s() first", Traits::Name());
+    if(!g_AdMob->m_FormatEnabled[Traits::TYPE])
+        return luaL_error(L, "The %s ads are disabled in game.project (admob.%s_enabled)", Traits::Name(), Traits::Name());
+    if(IsLoadPending(Traits::TYPE))
+        return luaL_error(L, "Ad is still loading! Wait for the sdk to be ready");
+    if(ad->m_AdUnit != 0)
+        return luaL_error(L, "Ad is still loading or unloading! Wait for its callback");
+
+    // Without an ad unit, the next one of the Remote Config waterfall is loaded
+    const char* ad_unit;
+    uint32_t tuned_ad_unit = 0;
+    if( lua_isnil(L, 1) )
+    {
+        const AdMobExtension::TuningFormat* tuning = &AdMobExtension::TuningGet()->m_Formats[Traits::TYPE];
+        if( tuning->m_NumAdUnits == 0 )
+            return luaL_error(L, "No ad unit given, and none is set in Remote Config (admob_%s_ad_units)", Traits::Name());
+        uint32_t index = g_AdMob->m_Waterfall[Traits::TYPE] % tuning->m_NumAdUnits;
+        ad_unit = tuning->m_AdUnits[index];
+        tuned_ad_unit = index + 1;
+    }
+    else
+    {
+        ad_unit = luaL_checkstring(L, 1);
+    }
 
-    const char* ad_unit = luaL_checkstring(L, 1);
-    ad->m_AdUnit = strdup(ad_unit);
+    // All the arguments are checked before the ad is changed: a Lua error must not leave the slot half loaded
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+    firebase::admob::AdSize ad_size;
+    if( Traits::IS_VIEW )
+    {
+        ad_size.ad_size_type = firebase::admob::kAdSizeStandard;
+        ad_size.width = CheckTableNumber(L, 2, "width", 320);
+        ad_size.height = CheckTableNumber(L, 2, "height", 100);
+    }
+    DeleteAdRequest(ad->m_AdRequest); // The lists parsed by an earlier load, that failed on a later list
     SetupAdRequest(L, 2, ad->m_AdRequest);
+
+    ad->m_Type = Traits::TYPE;
+    ad->m_AdUnit = AdMobExtension::StrDup(ad_unit);
+    ad->m_TunedAdUnit = (uint8_t)tuned_ad_unit;
+    ad->m_StatsIndex = AdMobExtension::StatsRegisterAdUnit(ad_unit);
+    AdMobExtension::StatsAddRequest(ad->m_StatsIndex);
+    AdMobExtension::ProfileAddCount(AdMobExtension::PROFILE_COUNTER_LOAD_CALLS, 1);
     RegisterCallback(L, 3, &ad->m_Callback);
+    if( Traits::IS_VIEW )
+        ad->m_AdSize = ad_size;
+    ad->m_AdParent = GetAdParent();
 
-    firebase::admob::AdSize ad_size;
-    ad_size.ad_size_type = firebase::admob::kAdSizeStandard;
-    ad_size.width = CheckTableNumber(L, 2, "width", 320);
-    ad_size.height = CheckTableNumber(L, 2, "height", 100);
-
-    ad->m_Type = AdMobExtension::ADMOB_TYPE_BANNER;
-    ad->m_BannerView = new firebase::admob::BannerView();
-    ad->m_BannerView->Initialize(GetAdParent(), ad->m_AdUnit, ad_size);
-    ad->m_BannerView->InitializeLastResult().OnCompletion(OnCompletionCallback, ad);
+    StartLoad(ad);
     return 0;
 }
 
-static int BannerShow(lua_State* L)
+template<typename T> static int ViewShow(lua_State* L)
 {
     DM_LUA_STACK_CHECK(L, 0);
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER];
+    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::AdFormatTraits<T>::TYPE];
     if(ad->m_Initialized == 0)
         return luaL_error(L, "Ad is not loaded!");
-    ad->m_BannerView->Show();
+    SetViewVisible(ad, true);
     return 0;
 }
 
-static int BannerHide(lua_State* L)
+template<typename T> static int ViewHide(lua_State* L)
 {
     DM_LUA_STACK_CHECK(L, 0);
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER];
+    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::AdFormatTraits<T>::TYPE];
     if(ad->m_Initialized == 0)
         return luaL_error(L, "Ad is not loaded!");
-    ad->m_BannerView->Hide();
+    SetViewVisible(ad, false);
     return 0;
 }
 
-static int BannerMoveTo(lua_State* L)
+template<typename T> static int ViewMoveTo(lua_State* L)
 {
     DM_LUA_STACK_CHECK(L, 0);
 
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER];
+    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::AdFormatTraits<T>::TYPE];
     if(ad->m_Initialized == 0)
         return luaL_error(L, "Ad is not loaded!");
 
-    assert( (int)firebase::admob::BannerView::kPositionTop == (int)firebase::admob::NativeExpressAdView::kPositionTop );
-    assert( (int)firebase::admob::BannerView::kPositionBottom == (int)firebase::admob::NativeExpressAdView::kPositionBottom );
-    assert( (int)firebase::admob::BannerView::kPositionTopLeft == (int)firebase::admob::NativeExpressAdView::kPositionTopLeft );
-    assert( (int)firebase::admob::BannerView::kPositionTopRight == (int)firebase::admob::NativeExpressAdView::kPositionTopRight );
-    assert( (int)firebase::admob::BannerView::kPositionBottomLeft == (int)firebase::admob::NativeExpressAdView::kPositionBottomLeft );
-    assert( (int)firebase::admob::BannerView::kPositionBottomRight == (int)firebase::admob::NativeExpressAdView::kPositionBottomRight );
-
     if(lua_gettop(L) == 1)
     {
         int _pos = luaL_checkint(L, 1);
         if( _pos < AdMobExtension::ADMOB_POSITION_TOP || _pos > AdMobExtension::ADMOB_POSITION_BOTTOMRIGHT )
             return luaL_error(L, "Invalid position: %d", _pos);
 
-        ad->m_BannerView->MoveTo((firebase::admob::BannerView::Position)_pos);
+        SetViewPosition(ad, _pos, 0, 0);
     }
     else
     {
         int x = luaL_checkint(L, 1);
         int y = luaL_checkint(L, 2);
-        ad->m_BannerView->MoveTo(x, y);
+        SetViewPosition(ad, -1, x, y);
     }
     return 0;
 }
 
-static int BannerUnload(lua_State* L)
-{
-    DM_LUA_STACK_CHECK(L, 0);
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER];
-    if(ad->m_Initialized == 0)
-        return luaL_error(L, "Ad is not loaded!");
-    QueueCommand(AdMobExtension::ADMOB_TYPE_BANNER, AdMobExtension::ADMOB_MESSAGE_UNLOADED, 0, 0, DeleteCommandCallback);
-    return 0;
-}
-
 ////////////////////////////////////////////////////////
-// NATIVE EXPRESS
+// BANNER
 
-static int NativeExpressLoad(lua_State* L)
+static int BannerLoad(lua_State* L)
 {
-    DM_LUA_STACK_CHECK(L, 0);
+    return LoadFormat<firebase::admob::BannerView>(L);
+}
 
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS];
-    if(ad->m_Initialized != 0)
-        return luaL_error(L, "Ad is still loaded! Call admob.nativeexpress_unload() first");
+static int BannerShow(lua_State* L)
+{
+    return ViewShow<firebase::admob::BannerView>(L);
+}
 
-    const char* ad_unit = luaL_checkstring(L, 1);
-    ad->m_AdUnit = strdup(ad_unit);
-    SetupAdRequest(L, 2, ad->m_AdRequest);
-    RegisterCallback(L, 3, &ad->m_Callback);
+static int BannerHide(lua_State* L)
+{
+    return ViewHide<firebase::admob::BannerView>(L);
+}
 
-    firebase::admob::AdSize ad_size;
-    ad_size.ad_size_type = firebase::admob::kAdSizeStandard;
-    ad_size.width = CheckTableNumber(L, 2, "width", 320);
-    ad_size.height = CheckTableNumber(L, 2, "height", 100);
-
-    ad->m_Type = AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS;
-    ad->m_NativeExpressAdView = new firebase::admob::NativeExpressAdView();
-    ad->m_NativeExpressAdView->Initialize(GetAdParent(), ad->m_AdUnit, ad_size);
-    ad->m_NativeExpressAdView->InitializeLastResult().OnCompletion(OnCompletionCallback, ad);
-    return 0;
+static int BannerMoveTo(lua_State* L)
+{
+    return ViewMoveTo<firebase::admob::BannerView>(L);
 }
 
-static int NativeExpressShow(lua_State* L)
+// admob.anchor_banner(anchor, [threshold]), where the anchor is a vector3 (that can be updated in place),
+// a function returning a vector3 or x, y (e.g. the screen position of a gui node), or nil to remove the anchor
+static int SetAnchor(lua_State* L, ::AdMobAd* ad)
 {
-    DM_LUA_STACK_CHECK(L, 0);
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS];
     if(ad->m_Initialized == 0)
         return luaL_error(L, "Ad is not loaded!");
-    ad->m_NativeExpressAdView->Show();
+
+    uint32_t bit = 1u << ad->m_Type;
+    UnregisterCallback(&ad->m_Anchor);
+    g_AdMob->m_AnchoredViews &= ~bit;
+    if( lua_isnoneornil(L, 1) )
+        return 0;
+
+    if( lua_type(L, 1) == LUA_TFUNCTION )
+    {
+        RegisterCallback(L, 1, &ad->m_Anchor);
+        ad->m_AnchorIsFunction = 1;
+    }
+    else
+    {
+        dmScript::CheckVector3(L, 1);
+        ad->m_Anchor.m_L = dmScript::GetMainThread(L);
+        lua_pushvalue(L, 1);
+        ad->m_Anchor.m_Callback = dmScript::Ref(L, LUA_REGISTRYINDEX);
+        ad->m_Anchor.m_Self = LUA_NOREF;
+        ad->m_AnchorIsFunction = 0;
+    }
+    ad->m_AnchorThreshold = luaL_optint(L, 2, g_AdMob->m_AnchorThreshold);
+    g_AdMob->m_AnchoredViews |= bit;
     return 0;
 }
 
-static int NativeExpressHide(lua_State* L)
+static int BannerAnchor(lua_State* L)
 {
     DM_LUA_STACK_CHECK(L, 0);
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS];
-    if(ad->m_Initialized == 0)
-        return luaL_error(L, "Ad is not loaded!");
-    ad->m_NativeExpressAdView->Hide();
-    return 0;
+    return SetAnchor(L, &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER]);
 }
 
-static int NativeExpressMoveTo(lua_State* L)
+static int BannerUnload(lua_State* L)
 {
     DM_LUA_STACK_CHECK(L, 0);
+    return UnloadAd(L, &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER]);
+}
 
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS];
-    if(ad->m_Initialized == 0)
-        return luaL_error(L, "Ad is not loaded!");
+////////////////////////////////////////////////////////
+// NATIVE EXPRESS
 
-    assert( (int)firebase::admob::BannerView::kPositionTop == (int)firebase::admob::NativeExpressAdView::kPositionTop );
-    assert( (int)firebase::admob::BannerView::kPositionBottom == (int)firebase::admob::NativeExpressAdView::kPositionBottom );
-    assert( (int)firebase::admob::BannerView::kPositionTopLeft == (int)firebase::admob::NativeExpressAdView::kPositionTopLeft );
-    assert( (int)firebase::admob::BannerView::kPositionTopRight == (int)firebase::admob::NativeExpressAdView::kPositionTopRight );
-    assert( (int)firebase::admob::BannerView::kPositionBottomLeft == (int)firebase::admob::NativeExpressAdView::kPositionBottomLeft );
-    assert( (int)firebase::admob::BannerView::kPositionBottomRight == (int)firebase::admob::NativeExpressAdView::kPositionBottomRight );
+static int NativeExpressLoad(lua_State* L)
+{
+    return LoadFormat<firebase::admob::NativeExpressAdView>(L);
+}
 
-    if(lua_gettop(L) == 1)
-    {
-        int _pos = luaL_checkint(L, 1);
-        if( _pos < AdMobExtension::ADMOB_POSITION_TOP || _pos > AdMobExtension::ADMOB_POSITION_BOTTOMRIGHT )
-            return luaL_error(L, "Invalid position: %d", _pos);
+static int NativeExpressShow(lua_State* L)
+{
+    return ViewShow<firebase::admob::NativeExpressAdView>(L);
+}
 
-        ad->m_NativeExpressAdView->MoveTo((firebase::admob::NativeExpressAdView::Position)_pos);
-    }
-    else
-    {
-        int x = luaL_checkint(L, 1);
-        int y = luaL_checkint(L, 2);
-        ad->m_NativeExpressAdView->MoveTo(x, y);
-    }
-    return 0;
+static int NativeExpressHide(lua_State* L)
+{
+    return ViewHide<firebase::admob::NativeExpressAdView>(L);
+}
+
+static int NativeExpressMoveTo(lua_State* L)
+{
+    return ViewMoveTo<firebase::admob::NativeExpressAdView>(L);
+}
+
+static int NativeExpressAnchor(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 0);
+    return SetAnchor(L, &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS]);
 }
 
 static int NativeExpressUnload(lua_State* L)
 {
     DM_LUA_STACK_CHECK(L, 0);
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS];
-    if(ad->m_Initialized == 0)
-        return luaL_error(L, "Ad is not loaded!");
-    QueueCommand(AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS, AdMobExtension::ADMOB_MESSAGE_UNLOADED, 0, 0, DeleteCommandCallback);
-    return 0;
+    return UnloadAd(L, &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS]);
 }
 
 ////////////////////////////////////////////////////////
 // INTERSTITIAL
 
-static int InterstitialLoad(lua_State* L)
+// Counts the show of a fullscreen ad. Returns false if the show cap from Remote Config is reached
+static bool CountShow(::AdMobAd* ad)
 {
-    DM_LUA_STACK_CHECK(L, 0);
-
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_INTERSTITIAL];
-    if(ad->m_Initialized != 0)
-        return luaL_error(L, "Ad is still loaded! Call admob.nativeexpress_unload() first");
-
-    const char* ad_unit = luaL_checkstring(L, 1);
-    ad->m_AdUnit = strdup(ad_unit);
-    SetupAdRequest(L, 2, ad->m_AdRequest);
-    RegisterCallback(L, 3, &ad->m_Callback);
+    uint32_t cap = AdMobExtension::TuningGet()->m_Formats[ad->m_Type].m_ShowCap;
+    if( cap && g_AdMob->m_Shows[ad->m_Type] >= cap )
+    {
+        AdMobExtension::ProfileAddCount(AdMobExtension::PROFILE_COUNTER_CAPPED_SHOWS, 1);
+        return false;
+    }
+    ++g_AdMob->m_Shows[ad->m_Type];
+    return true;
+}
 
-    ad->m_Type = AdMobExtension::ADMOB_TYPE_INTERSTITIAL;
-    ad->m_InterstitialAd = new firebase::admob::InterstitialAd();
-    ad->m_InterstitialAd->Initialize(GetAdParent(), ad->m_AdUnit);
-    ad->m_InterstitialAd->InitializeLastResult().OnCompletion(OnCompletionCallback, ad);
-    return 0;
+static int InterstitialLoad(lua_State* L)
+{
+    return LoadFormat<firebase::admob::InterstitialAd>(L);
 }
 
 static int InterstitialShow(lua_State* L)
 {
-    DM_LUA_STACK_CHECK(L, 0);
+    DM_LUA_STACK_CHECK(L, 1);
     ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_INTERSTITIAL];
     if(ad->m_Initialized == 0)
         return luaL_error(L, "Ad is not loaded!");
-    ad->m_InterstitialAd->Show();
-    return 0;
+    bool show = CountShow(ad);
+    if( show )
+        ad->m_InterstitialAd->Show();
+    lua_pushboolean(L, show);
+    return 1;
 }
 
 static int InterstitialUnload(lua_State* L)
 {
     DM_LUA_STACK_CHECK(L, 0);
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_INTERSTITIAL];
-    if(ad->m_Initialized == 0)
-        return luaL_error(L, "Ad is not loaded!");
-    QueueCommand(AdMobExtension::ADMOB_TYPE_INTERSTITIAL, AdMobExtension::ADMOB_MESSAGE_UNLOADED, 0, 0, DeleteCommandCallback);
-    return 0;
+    return UnloadAd(L, &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_INTERSTITIAL]);
 }
 
 ////////////////////////////////////////////////////////
@@ -853,43 +1835,190 @@ static int InterstitialUnload(lua_State* L)
 
 static int RewardedVideoLoad(lua_State* L)
 {
-    DM_LUA_STACK_CHECK(L, 0);
-
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_REWARDEDVIDEO];
-    if(ad->m_Initialized != 0)
-        return luaL_error(L, "Ad is still loaded! Call admob.nativeexpress_unload() first");
-
-    const char* ad_unit = luaL_checkstring(L, 1);
-    ad->m_AdUnit = strdup(ad_unit);
-    SetupAdRequest(L, 2, ad->m_AdRequest);
-    RegisterCallback(L, 3, &ad->m_Callback);
-
-    ad->m_Type = AdMobExtension::ADMOB_TYPE_REWARDEDVIDEO;
-    firebase::admob::rewarded_video::InitializeLastResult().OnCompletion(OnCompletionCallback, ad);
-    return 0;
+    return LoadFormat<AdMobExtension::RewardedVideoFormat>(L);
 }
 
 static int RewardedVideoShow(lua_State* L)
 {
-    DM_LUA_STACK_CHECK(L, 0);
+    DM_LUA_STACK_CHECK(L, 1);
     ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_REWARDEDVIDEO];
     if(ad->m_Initialized == 0)
         return luaL_error(L, "Ad is not loaded!");
-    firebase::admob::rewarded_video::Show(GetAdParent());
-    return 0;
+    bool show = CountShow(ad);
+    if( show )
+        firebase::admob::rewarded_video::Show(GetAdParent());
+    lua_pushboolean(L, show);
+    return 1;
 }
 
 static int RewardedVideoUnload(lua_State* L)
 {
     DM_LUA_STACK_CHECK(L, 0);
-    ::AdMobAd* ad = &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_REWARDEDVIDEO];
-    if(ad->m_Initialized == 0)
-        return luaL_error(L, "Ad is not loaded!");
-    QueueCommand(AdMobExtension::ADMOB_TYPE_REWARDEDVIDEO, AdMobExtension::ADMOB_MESSAGE_UNLOADED, 0, 0, DeleteCommandCallback);
-    return 0;
+    return UnloadAd(L, &g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_REWARDEDVIDEO]);
+}
+
+////////////////////////////////////////////////////////
+// STATS
+
+static int GetStats(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+    AdMobExtension::StatsPushTable(L);
+    return 1;
+}
+
+////////////////////////////////////////////////////////
+// TUNING
+
+static int GetTuning(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+    AdMobExtension::TuningPushTable(L);
+    return 1;
+}
+
+////////////////////////////////////////////////////////
+// REMOTE CONFIG
+
+// remote_config.snapshot([prefix]). The table is rebuilt after the values were activated (see TuningActivateRemoteConfig())
+static int RemoteConfigSnapshot(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+    const char* prefix = luaL_optstring(L, 1, "");
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+    if( g_AdMob && g_AdMob->m_App && g_AdMob->m_InitTask->m_ModuleReady[ADMOB_MODULE_REMOTE_CONFIG] )
+    {
+        AdMobExtension::ConfigSnapshotPush(L, prefix, AdMobExtension::TuningGet()->m_Version);
+        return 1;
+    }
+#endif
+    (void)prefix;
+    lua_newtable(L); // Remote Config isn't initialized (yet)
+    return 1;
+}
+
+////////////////////////////////////////////////////////
+// PROFILE
+
+static int GetProfile(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+    AdMobExtension::ProfilePushTable(L);
+    return 1;
+}
+
+////////////////////////////////////////////////////////
+// JOURNAL
+
+static int SaveJournal(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+    const char* path = luaL_checkstring(L, 1);
+    if( !AdMobExtension::JournalIsEnabled() )
+        return DM_LUA_ERROR("The journal is disabled. Set admob.journal_size in game.project");
+    lua_pushboolean(L, AdMobExtension::JournalSave(path));
+    return 1;
+}
+
+// Delivers all the recorded commands to the callback, as fast as possible. They don't go through the command queue,
+// so that it can be called from an ad callback, and the live ads are not involved.
+// Returns the number of commands and the time it took (seconds)
+static int ReplayJournal(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 2);
+    const char* path = luaL_checkstring(L, 1);
+
+    LuaCallbackInfo cbk;
+    RegisterCallback(L, 2, &cbk);
+
+    uint32_t count = 0;
+    AdMobExtension::JournalRecord* records = AdMobExtension::JournalLoad(path, &count);
+
+    uint64_t start = dmTime::GetTime();
+    uint32_t replayed = 0;
+    for( uint32_t i = 0; i < count; ++i)
+    {
+        AdMobExtension::JournalRecord* record = &records[i];
+        if( record->m_Id < 0 || record->m_Id >= ADMOB_MAX_ADS )
+            continue;
+
+        MessageCommand cmd;
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.m_Id = record->m_Id;
+        cmd.m_Message = record->m_Message;
+        cmd.m_FirebaseResult = record->m_FirebaseResult;
+        cmd.m_Reward = record->m_Reward;
+        cmd.m_Time = record->m_QueueTime;
+        AdMobExtension::JournalGetString(record->m_FirebaseMessage, record->m_MessageLength, cmd.m_InlineMessage, sizeof(cmd.m_InlineMessage));
+
+        char ad_unit[sizeof(record->m_AdUnit) + 1];
+        AdMobExtension::JournalGetString(record->m_AdUnit, record->m_AdUnitLength, ad_unit, sizeof(ad_unit));
+
+        firebase::admob::BoundingBox box;
+        box.x = record->m_Box[0];
+        box.y = record->m_Box[1];
+        box.width = record->m_Box[2];
+        box.height = record->m_Box[3];
+
+        InvokeCallback(&cbk, &cmd, record->m_Type, ad_unit, (record->m_Flags & AdMobExtension::JOURNAL_FLAG_BOX) ? &box : 0);
+        ++replayed;
+    }
+    uint64_t end = dmTime::GetTime();
+
+    UnregisterCallback(&cbk);
+    AdMobExtension::Free(records);
+
+    lua_pushnumber(L, replayed);
+    lua_pushnumber(L, (end - start) / 1000000.0);
+    return 2;
+}
+
+////////////////////////////////////////////////////////
+// LAYOUT
+
+// Returns the cached bounding box (x, y, width, height) of a loaded banner type, or nil
+static int GetBounds(lua_State* L)
+{
+    int type = luaL_checkint(L, 1);
+    if( type != AdMobExtension::ADMOB_TYPE_BANNER && type != AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS )
+        return luaL_error(L, "Invalid ad type: %d (only banners and native express ads have bounds)", type);
+
+    firebase::admob::BoundingBox box;
+    if( !g_AdMob->m_Ads[type].m_Initialized || !AdMobExtension::GetBoundingBox(&g_AdMob->m_Bounds[type], &box) )
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushnumber(L, box.x);
+    lua_pushnumber(L, box.y);
+    lua_pushnumber(L, box.width);
+    lua_pushnumber(L, box.height);
+    return 4;
 }
 
 ////////////////////////////////////////////////////////
+// INITIALIZATION
+
+static int IsReady(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+    lua_pushboolean(L, g_AdMob->m_InitState == ADMOB_INIT_READY);
+    return 1;
+}
+
+static int SetReadyCallback(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 0);
+    RegisterCallback(L, 1, &g_AdMob->m_ReadyCallback);
+
+    // The initialization may have finished before the callback was set
+    if( g_AdMob->m_InitState != ADMOB_INIT_PENDING )
+    {
+        int result = g_AdMob->m_InitState == ADMOB_INIT_READY ? firebase::kInitResultSuccess : g_AdMob->m_InitTask->m_Result;
+        AdMobExtension::QueueCommand(0, AdMobExtension::ADMOB_MESSAGE_READY, result, 0, 0);
+    }
+    return 0;
+}
 
 static const luaL_reg Module_methods[] =
 {
@@ -897,12 +2026,14 @@ static const luaL_reg Module_methods[] =
     {"show_banner", BannerShow},
     {"hide_banner", BannerHide},
     {"move_banner", BannerMoveTo},
+    {"anchor_banner", BannerAnchor},
     {"unload_banner", BannerUnload},
 
     {"load_nativeexpress", NativeExpressLoad},
     {"show_nativeexpress", NativeExpressShow},
     {"hide_nativeexpress", NativeExpressHide},
     {"move_nativeexpress", NativeExpressMoveTo},
+    {"anchor_nativeexpress", NativeExpressAnchor},
     {"unload_nativeexpress", NativeExpressUnload},
 
     {"load_interstitial", InterstitialLoad},
@@ -913,6 +2044,24 @@ static const luaL_reg Module_methods[] =
     {"show_rewardedvideo", RewardedVideoShow},
     {"unload_rewardedvideo", RewardedVideoUnload},
 
+    {"get_bounds", GetBounds},
+
+    {"is_ready", IsReady},
+    {"set_ready_callback", SetReadyCallback},
+
+    {"get_stats", GetStats},
+    {"get_tuning", GetTuning},
+    {"get_profile", GetProfile},
+
+    {"save_journal", SaveJournal},
+    {"replay_journal", ReplayJournal},
+
+    {0, 0}
+};
+
+static const luaL_reg RemoteConfig_methods[] =
+{
+    {"snapshot", RemoteConfigSnapshot},
     {0, 0}
 };
 
@@ -934,6 +2083,7 @@ static void LuaInit(lua_State* L)
     SETCONSTANT(ERROR_NETWORKERROR);
     SETCONSTANT(ERROR_NOFILL);
     SETCONSTANT(ERROR_NOWINDOWTOKEN);
+    SETCONSTANT(ERROR_TIMEOUT);
 
     SETCONSTANT(TYPE_BANNER);
     SETCONSTANT(TYPE_INTERSTITIAL);
@@ -962,16 +2112,249 @@ static void LuaInit(lua_State* L)
     SETCONSTANT(MESSAGE_REWARD);
     SETCONSTANT(MESSAGE_APP_LEAVE);
     SETCONSTANT(MESSAGE_UNLOADED);
+    SETCONSTANT(MESSAGE_READY);
+    SETCONSTANT(MESSAGE_LAYOUT);
 
 #undef SETCONSTANT
 
     lua_pop(L, 1);
+
+    luaL_register(L, "remote_config", RemoteConfig_methods);
+    lua_pop(L, 1);
     assert(top == lua_gettop(L));
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
 // Extension interface functions
 
+static void JoinInitThread()
+{
+    if( !g_AdMob->m_InitTask->m_Running )
+        return;
+    dmThread::Join(g_AdMob->m_InitTask->m_Thread);
+    g_AdMob->m_InitTask->m_Running = false;
+}
+
+static void TerminateModules(AdMobInitTask* task)
+{
+    delete task->m_Initializer; // Holds a future, so before the modules are gone
+    task->m_Initializer = 0;
+
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+    if( task->m_ModuleReady[ADMOB_MODULE_REMOTE_CONFIG] )
+        firebase::remote_config::Terminate();
+#endif
+#if defined(ADMOB_WITH_ANALYTICS)
+    if( task->m_ModuleReady[ADMOB_MODULE_ANALYTICS] )
+        firebase::analytics::Terminate();
+#endif
+    if( task->m_ModuleReady[ADMOB_MODULE_ADMOB] )
+        firebase::admob::Terminate();
+    memset(task->m_ModuleReady, 0, sizeof(task->m_ModuleReady));
+
+    delete task->m_App;
+    task->m_App = 0;
+}
+
+// Takes over the app from the init task, once the modules are initialized
+static void FinishInitialization()
+{
+    JoinInitThread();
+
+    AdMobInitTask* task = g_AdMob->m_InitTask;
+    AdMobExtension::Free(task->m_AppId);
+    task->m_AppId = 0;
+
+    for( uint32_t i = 0; i < ADMOB_MODULE_MAX; ++i )
+    {
+        if( task->m_ModuleEnabled[i] )
+            dmLogInfo("AdMob: module %s %s in %.1f ms", ADMOB_MODULE_NAMES[i], task->m_ModuleReady[i] ? "initialized" : "failed", task->m_ModuleDuration[i] / 1000.0);
+    }
+
+    if( task->m_Result != firebase::kInitResultSuccess )
+    {
+        TerminateModules(task);
+    }
+    g_AdMob->m_App = task->m_App;
+    g_AdMob->m_InitState = g_AdMob->m_App ? ADMOB_INIT_READY : ADMOB_INIT_FAILED;
+}
+
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+static const uint64_t ADMOB_FETCH_RETRY_INTERVAL = 15 * 60; // Seconds, after a failed fetch
+static const uint64_t ADMOB_FETCH_TIMEOUT = 60 * 1000000; // Microseconds. A fetch that hangs would stop the later fetches
+
+// The next fetch is made after the delay, plus up to 10% of jitter (so that the clients don't all fetch at once)
+static void ScheduleRemoteConfigFetch(uint64_t delay)
+{
+    g_AdMob->m_FetchJitter = g_AdMob->m_FetchJitter * 1664525 + 1013904223;
+    uint64_t jitter = delay * 100000 * (g_AdMob->m_FetchJitter >> 16) / 0xFFFF;
+    g_AdMob->m_NextFetch = dmTime::GetTime() + delay * 1000000 + jitter;
+}
+
+// Runs on the worker thread (if enabled)
+static void ActivateRemoteConfigJob(int id)
+{
+    (void)id;
+    AdMobExtension::TuningActivateRemoteConfig();
+}
+
+// Runs on the main thread
+static void RemoteConfigFetchedCommandCallback(int id)
+{
+    (void)id;
+    AdMobExtension::WorkerRun(ActivateRemoteConfigJob, 0, AdMobExtension::WORKER_GROUP_NONE);
+    ScheduleRemoteConfigFetch(g_AdMob->m_FetchInterval);
+}
+
+// Runs on the main thread
+static void RemoteConfigFetchFailedCommandCallback(int id)
+{
+    (void)id;
+    uint64_t interval = g_AdMob->m_FetchInterval;
+    ScheduleRemoteConfigFetch(interval < ADMOB_FETCH_RETRY_INTERVAL ? interval : ADMOB_FETCH_RETRY_INTERVAL);
+}
+
+// Called on a Firebase thread, or on the main thread if the fetch timed out
+static void OnRemoteConfigFetched(int error, const char* error_message, void* user_data)
+{
+    (void)user_data;
+    if( error != 0 )
+        dmLogWarning("AdMob: the remote config fetch failed: %d %s", error, error_message);
+    AdMobExtension::QueueStateCommand(0, ADMOB_MESSAGE_INTERNAL, error, 0,
+                    error == 0 ? RemoteConfigFetchedCommandCallback : RemoteConfigFetchFailedCommandCallback, 0);
+}
+
+// Runs on the worker thread (if enabled). The values younger than the interval are taken from the cache
+static void FetchRemoteConfigJob(int id)
+{
+    (void)id;
+    AdMobExtension::HFuture fetch = AdMobExtension::FutureFrom(firebase::remote_config::Fetch(g_AdMob->m_FetchInterval));
+    AdMobExtension::FutureOnCompletion(AdMobExtension::FutureTimeout(fetch, ADMOB_FETCH_TIMEOUT), OnRemoteConfigFetched, 0);
+}
+
+static void StartRemoteConfigFetch()
+{
+    g_AdMob->m_NextFetch = 0;
+    AdMobExtension::WorkerRun(FetchRemoteConfigJob, 0, AdMobExtension::WORKER_GROUP_NONE);
+}
+#endif
+
+// Runs on the main thread, before the ready message is sent to Lua
+static void ReadyCommandCallback(int id)
+{
+    (void)id;
+    FinishInitialization();
+
+#if defined(ADMOB_WITH_ANALYTICS)
+    if( g_AdMob->m_App && g_AdMob->m_InitTask->m_ModuleReady[ADMOB_MODULE_ANALYTICS] && g_AdMob->m_AnalyticsAdEvents )
+        AdMobExtension::AnalyticsStart();
+#endif
+
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+    // The values activated in an earlier session are used until the first fetch is done
+    if( g_AdMob->m_App && g_AdMob->m_InitTask->m_ModuleReady[ADMOB_MODULE_REMOTE_CONFIG] )
+    {
+        AdMobExtension::WorkerRun(ActivateRemoteConfigJob, 0, AdMobExtension::WORKER_GROUP_NONE);
+        StartRemoteConfigFetch();
+    }
+#endif
+
+    dmLogInfo("AdMob %s after %.1f ms (%.1f ms in the sdk)", g_AdMob->m_App ? "fully initialized" : "failed to initialize",
+                    (dmTime::GetTime() - g_AdMob->m_StartTime) / 1000.0, g_AdMob->m_InitTask->m_Duration / 1000.0);
+
+    StartPendingLoads();
+}
+
+// The module initializers are called by the ModuleInitializer (on the init thread, and again if Google Play services needed fixing)
+
+static firebase::InitResult SetModuleResult(AdMobInitTask* task, AdMobModule module, firebase::InitResult result, uint64_t start)
+{
+    task->m_ModuleDuration[module] = dmTime::GetTime() - start;
+    task->m_ModuleReady[module] = result == firebase::kInitResultSuccess;
+    if( result != firebase::kInitResultSuccess )
+        dmLogError("Could not initialize %s, result: %d", ADMOB_MODULE_NAMES[module], result);
+    return result;
+}
+
+static firebase::InitResult InitializeAdMobModule(firebase::App* app, void* context)
+{
+    AdMobInitTask* task = (AdMobInitTask*)context;
+    uint64_t start = dmTime::GetTime();
+    task->m_Result = firebase::admob::Initialize(*app, task->m_AppId);
+    return SetModuleResult(task, ADMOB_MODULE_ADMOB, (firebase::InitResult)task->m_Result, start);
+}
+
+#if defined(ADMOB_WITH_ANALYTICS)
+static firebase::InitResult InitializeAnalyticsModule(firebase::App* app, void* context)
+{
+    uint64_t start = dmTime::GetTime();
+    firebase::analytics::Initialize(*app);
+    return SetModuleResult((AdMobInitTask*)context, ADMOB_MODULE_ANALYTICS, firebase::kInitResultSuccess, start);
+}
+#endif
+
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+static firebase::InitResult InitializeRemoteConfigModule(firebase::App* app, void* context)
+{
+    uint64_t start = dmTime::GetTime();
+    return SetModuleResult((AdMobInitTask*)context, ADMOB_MODULE_REMOTE_CONFIG, firebase::remote_config::Initialize(*app), start);
+}
+#endif
+
+// Called when all the modules are initialized (or failed)
+static void OnModulesInitialized(const firebase::Future<void>& future, void* user_data)
+{
+    (void)future;
+    AdMobInitTask* task = (AdMobInitTask*)user_data;
+    DM_MUTEX_SCOPED_LOCK(task->m_Mutex);
+    task->m_Done = true;
+    if( task->m_Abandoned ) // The extension (and the command queue) is gone
+        return;
+    task->m_Duration = dmTime::GetTime() - task->m_Start;
+
+    // The main thread takes over the app when it gets the command
+    AdMobExtension::QueueStateCommand(0, AdMobExtension::ADMOB_MESSAGE_READY, task->m_Result, 0, ReadyCommandCallback, 0);
+}
+
+// Runs on the init thread
+static void InitThread(void* arg)
+{
+    AdMobInitTask* task = (AdMobInitTask*)arg;
+    task->m_Start = dmTime::GetTime();
+
+#if defined(__ANDROID__)
+    task->m_App = firebase::App::Create(firebase::AppOptions(), AdMobExtension::GetJNIEnv(), dmGraphics::GetNativeAndroidActivity());
+#else
+    task->m_App = firebase::App::Create(firebase::AppOptions());
+#endif
+
+    if(!task->m_App)
+    {
+        dmLogError("firebase::App::Create failed");
+        task->m_Result = firebase::kInitResultFailedMissingDependency;
+        OnModulesInitialized(firebase::Future<void>(), task);
+        return;
+    }
+
+    // AdMob first: the ModuleInitializer runs the initializers in order, and stops at the first failure
+    firebase::ModuleInitializer::InitializerFn fns[ADMOB_MODULE_MAX];
+    uint32_t count = 0;
+    fns[count++] = InitializeAdMobModule;
+#if defined(ADMOB_WITH_ANALYTICS)
+    if( task->m_ModuleEnabled[ADMOB_MODULE_ANALYTICS] )
+        fns[count++] = InitializeAnalyticsModule;
+#endif
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+    if( task->m_ModuleEnabled[ADMOB_MODULE_REMOTE_CONFIG] )
+        fns[count++] = InitializeRemoteConfigModule;
+#endif
+
+    task->m_Result = firebase::kInitResultFailedMissingDependency;
+    task->m_Initializer = new firebase::ModuleInitializer;
+    task->m_Initializer->Initialize(task->m_App, task, fns, count);
+    task->m_Initializer->InitializeLastResult().OnCompletion(OnModulesInitialized, task);
+}
+
 static dmExtension::Result AppInitializeExtension(dmExtension::AppParams* params)
 {
     if (g_AdMob) {
@@ -981,7 +2364,13 @@ static dmExtension::Result AppInitializeExtension(dmExtension::AppParams* params
 
     // Of course, it's possible to have an "admob.init(appid)" function, but quite often
     // it's nice to have the game projects change depending on what build you're using (DEV, QA, RELEASE etc)
-#if defined(__ANDROID__)
+#if defined(ADMOB_FAKE_BACKEND)
+    const char* app_id = dmConfigFile::GetString(params->m_ConfigFile, "admob.app_id_ios", "fake");
+
+    AdMobExtension::FakeBackendParams fake_params;
+    AdMobExtension::FakeBackendGetConfigParams(params->m_ConfigFile, &fake_params);
+    AdMobExtension::FakeBackendSetParams(fake_params);
+#elif defined(__ANDROID__)
     const char* app_id = dmConfigFile::GetString(params->m_ConfigFile, "admob.app_id_android", 0);
 #else
     const char* app_id = dmConfigFile::GetString(params->m_ConfigFile, "admob.app_id_ios", 0);
@@ -992,40 +2381,102 @@ static dmExtension::Result AppInitializeExtension(dmExtension::AppParams* params
         return dmExtension::RESULT_OK;
     }
 
-#if defined(__ANDROID__)
-    firebase::App* app = firebase::App::Create(firebase::AppOptions(), GetJNIEnv(), dmGraphics::GetNativeAndroidActivity());
-#else
-    firebase::App* app = firebase::App::Create(firebase::AppOptions());
-#endif
-
-    if(!app)
+    g_AdMob = new ::AdMobState;
+    RegisterAdFormats();
+    g_AdMob->m_App = 0;
+    g_AdMob->m_CoveringUIAd = -1;
+    g_AdMob->m_CmdQueueMutex = dmMutex::New();
+    g_AdMob->m_CmdQueue.SetCapacity(8);
+    g_AdMob->m_CmdQueueFlush.SetCapacity(8);
+    g_AdMob->m_Flushing = false;
+    g_AdMob->m_InitState = ADMOB_INIT_PENDING;
+    g_AdMob->m_StartTime = dmTime::GetTime();
+    g_AdMob->m_FirstFrame = true;
+    g_AdMob->m_IdleAllocationsLogged = false;
+    g_AdMob->m_NumPendingLoads = 0;
+    g_AdMob->m_Background = false;
+    g_AdMob->m_DestroyedAds = 0;
+    g_AdMob->m_ChangedViews = 0;
+    g_AdMob->m_AnchoredViews = 0;
+    g_AdMob->m_AnchorThreshold = dmConfigFile::GetInt(params->m_ConfigFile, "admob.anchor_threshold", 2);
+    g_AdMob->m_Generation = 0;
+    g_AdMob->m_WatchedAds = 0;
+    g_AdMob->m_BackgroundStart = 0;
+    g_AdMob->m_NextFetch = 0;
+    g_AdMob->m_FetchJitter = (uint32_t)g_AdMob->m_StartTime;
+    for( uint32_t i = 0; i < ADMOB_MAX_ADS; ++i )
     {
-        dmLogError("firebase::App::Create failed");
-        return dmExtension::RESULT_OK;
+        AdMobExtension::ResetBoundingBox(&g_AdMob->m_Bounds[i]);
+        g_AdMob->m_Waterfall[i] = 0;
+        g_AdMob->m_Shows[i] = 0;
     }
-
-    firebase::InitResult res = firebase::admob::Initialize(*app, app_id);
-    if (res != firebase::kInitResultSuccess)
+    int view_pool_size = dmConfigFile::GetInt(params->m_ConfigFile, "admob.view_pool_size", 2);
+    if( view_pool_size < 0 || view_pool_size > ADMOB_MAX_VIEW_POOL_SIZE )
     {
-        delete app;
-        dmLogError("Could not initialize AdMob, result: %d", res);
-        return dmExtension::RESULT_OK;
+        dmLogWarning("AdMob: admob.view_pool_size must be in [0, %d], got %d", ADMOB_MAX_VIEW_POOL_SIZE, view_pool_size);
+        view_pool_size = view_pool_size < 0 ? 0 : ADMOB_MAX_VIEW_POOL_SIZE;
+    }
+    g_AdMob->m_RecycledViews.SetCapacity((uint32_t)view_pool_size);
+
+    const char* format_keys[ADMOB_MAX_ADS];
+    format_keys[AdMobExtension::ADMOB_TYPE_BANNER] = "admob.banner_enabled";
+    format_keys[AdMobExtension::ADMOB_TYPE_INTERSTITIAL] = "admob.interstitial_enabled";
+    format_keys[AdMobExtension::ADMOB_TYPE_REWARDEDVIDEO] = "admob.rewardedvideo_enabled";
+    format_keys[AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS] = "admob.nativeexpress_enabled";
+    for( uint32_t i = 0; i < ADMOB_MAX_ADS; ++i )
+    {
+        g_AdMob->m_FormatEnabled[i] = dmConfigFile::GetInt(params->m_ConfigFile, format_keys[i], 1) != 0;
+        g_AdMob->m_FormatInitialized[i] = false;
     }
 
-    firebase::admob::rewarded_video::Initialize();
-
-    g_AdMob = new ::AdMobState;
-    g_AdMob->m_App = app;
-    g_AdMob->m_CoveringUIAd = -1;
-    g_AdMob->m_CmdQueue.SetCapacity(8);
+    const char* timeout_keys[ADMOB_MAX_ADS];
+    timeout_keys[AdMobExtension::ADMOB_TYPE_BANNER] = "admob.banner_timeout";
+    timeout_keys[AdMobExtension::ADMOB_TYPE_INTERSTITIAL] = "admob.interstitial_timeout";
+    timeout_keys[AdMobExtension::ADMOB_TYPE_REWARDEDVIDEO] = "admob.rewardedvideo_timeout";
+    timeout_keys[AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS] = "admob.nativeexpress_timeout";
+    for( uint32_t i = 0; i < ADMOB_MAX_ADS; ++i )
+    {
+        int seconds = dmConfigFile::GetInt(params->m_ConfigFile, timeout_keys[i], 30);
+        g_AdMob->m_Timeouts[i] = seconds > 0 ? (uint64_t)seconds * 1000000 : 0;
+    }
 
-    dmLogInfo("AdMob fully initialized!");
+    AdMobExtension::StatsInit();
+    AdMobExtension::ProfileInit(dmConfigFile::GetInt(params->m_ConfigFile, "admob.profile", 0) != 0);
+    AdMobExtension::JournalInit((uint32_t)dmConfigFile::GetInt(params->m_ConfigFile, "admob.journal_size", 0));
+    AdMobExtension::WorkerInit(dmConfigFile::GetInt(params->m_ConfigFile, "admob.worker_thread", 0) != 0);
+    AdMobExtension::TuningInit();
+    AdMobExtension::FutureInit(ADMOB_FUTURE_POOL_SIZE);
+    AdMobExtension::AnalyticsInit();
+
+    // The Firebase initialization is slow, so it's done in the background. The loads made before it's done are queued.
+    AdMobInitTask* task = new AdMobInitTask;
+    memset(task, 0, sizeof(*task));
+    task->m_Mutex = dmMutex::New();
+    g_AdMob->m_InitTask = task;
+    task->m_AppId = AdMobExtension::StrDup(app_id);
+    task->m_ModuleEnabled[ADMOB_MODULE_ADMOB] = true;
+#if defined(ADMOB_WITH_ANALYTICS)
+    task->m_ModuleEnabled[ADMOB_MODULE_ANALYTICS] = dmConfigFile::GetInt(params->m_ConfigFile, "admob.analytics", 0) != 0;
+#endif
+    g_AdMob->m_AnalyticsAdEvents = dmConfigFile::GetInt(params->m_ConfigFile, "admob.analytics_ad_events", 0) != 0;
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+    task->m_ModuleEnabled[ADMOB_MODULE_REMOTE_CONFIG] = dmConfigFile::GetInt(params->m_ConfigFile, "admob.remote_config", 0) != 0;
+    int fetch_interval = dmConfigFile::GetInt(params->m_ConfigFile, "admob.remote_config_fetch_interval", 0);
+    g_AdMob->m_FetchInterval = fetch_interval > 0 ? (uint64_t)fetch_interval : firebase::remote_config::kDefaultCacheExpiration;
+#else
+    if( dmConfigFile::GetInt(params->m_ConfigFile, "admob.remote_config", 0) != 0 )
+        dmLogWarning("AdMob: admob.remote_config is set, but Remote Config isn't compiled in on this platform (see ADMOB_REMOTE_CONFIG in the README)");
+    g_AdMob->m_FetchInterval = 0;
+#endif
+    task->m_Running = true;
+    task->m_Thread = dmThread::New(InitThread, 0x10000, task, "admob_init");
 
     return dmExtension::RESULT_OK;
 }
 
 static dmExtension::Result InitializeExtension(dmExtension::Params* params)
 {
+    AdMobExtension::ConfigSnapshotInit();
     LuaInit(params->m_L);
     dmLogInfo("Registered %s Lua extension\n", MODULE_NAME);
     return dmExtension::RESULT_OK;
@@ -1036,18 +2487,67 @@ static dmExtension::Result AppFinalizeExtension(dmExtension::AppParams* params)
     if( !g_AdMob )
         return dmExtension::RESULT_OK;
 
+    DeleteDestroyedAds();
     for( uint32_t i = 0; i < ADMOB_MAX_ADS; ++i)
     {
         g_AdMob->m_Ads[i].Delete();
     }
+    DeleteRecycledViews();
+
+    AdMobExtension::WorkerFinalize();
+    UnregisterCallback(&g_AdMob->m_ReadyCallback);
+
+    if( g_AdMob->m_InitState == ADMOB_INIT_PENDING )
+    {
+        JoinInitThread();
+        AdMobInitTask* task = g_AdMob->m_InitTask;
+        bool done;
+        {
+            DM_MUTEX_SCOPED_LOCK(task->m_Mutex);
+            task->m_Abandoned = true;
+            done = task->m_Done;
+        }
+        if( !done )
+        {
+            // The sdk still refers to the task (and the app), so they're leaked
+            dmLogWarning("AdMob: exiting before the Firebase initialization is done, the app is not deleted");
+            g_AdMob->m_InitTask = 0;
+        }
+        else
+        {
+            FinishInitialization();
+        }
+    }
 
     if(g_AdMob->m_App)
     {
-        firebase::admob::rewarded_video::Destroy();
-        firebase::admob::Terminate();
-        delete g_AdMob->m_App;
+        for( uint32_t i = 0; i < ADMOB_MAX_ADS; ++i )
+        {
+            if( g_AdMob->m_FormatInitialized[i] )
+                g_AdFormats[i].m_FinalizeFormat();
+        }
+        AdMobExtension::AnalyticsFinalize();
+        TerminateModules(g_AdMob->m_InitTask);
+        g_AdMob->m_App = 0;
+    }
+
+    const char* profile_output = dmConfigFile::GetString(params->m_ConfigFile, "admob.profile_output", 0);
+    if( profile_output && AdMobExtension::ProfileIsEnabled() )
+    {
+        AdMobExtension::ProfileWriteJson(profile_output);
     }
 
+    AdMobExtension::StatsFinalize();
+    AdMobExtension::JournalFinalize();
+    AdMobExtension::TuningFinalize();
+    AdMobExtension::FutureFinalize();
+
+    if( g_AdMob->m_InitTask )
+    {
+        dmMutex::Delete(g_AdMob->m_InitTask->m_Mutex);
+        delete g_AdMob->m_InitTask;
+    }
+    dmMutex::Delete(g_AdMob->m_CmdQueueMutex);
     delete g_AdMob;
     g_AdMob = 0;
     return dmExtension::RESULT_OK;
@@ -1055,21 +2555,65 @@ static dmExtension::Result AppFinalizeExtension(dmExtension::AppParams* params)
 
 static dmExtension::Result FinalizeExtension(dmExtension::Params* params)
 {
+    (void)params;
+    AdMobExtension::ConfigSnapshotFinalize(); // Before the Lua context is gone
     return dmExtension::RESULT_OK;
 }
 
 static dmExtension::Result UpdateExtension(dmExtension::Params* params)
 {
+    (void)params;
     if( g_AdMob )
     {
-        AdMobExtension::FlushCommandQueue();
+        if( g_AdMob->m_FirstFrame )
+        {
+            g_AdMob->m_FirstFrame = false;
+            dmLogInfo("AdMob: first frame after %.1f ms (sdk %s)", (dmTime::GetTime() - g_AdMob->m_StartTime) / 1000.0,
+                            g_AdMob->m_InitState == ADMOB_INIT_PENDING ? "still initializing" : "ready");
+        }
+
+        int allocations = AdMobExtension::GetThreadAllocationCount();
+
+        bool idle = AdMobExtension::FlushCommandQueue() == 0;
+
+        if( g_AdMob->m_WatchedAds && !g_AdMob->m_Background )
+            CheckTimeouts();
+
+        AdMobExtension::FutureUpdate();
+
+        // A new snapshot may have other ad units, so the waterfalls restart
+        if( AdMobExtension::TuningUpdate() )
+            memset(g_AdMob->m_Waterfall, 0, sizeof(g_AdMob->m_Waterfall));
+
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+        if( g_AdMob->m_NextFetch && !g_AdMob->m_Background && dmTime::GetTime() >= g_AdMob->m_NextFetch )
+            StartRemoteConfigFetch();
+#endif
 
-        for(uint32_t i = 0; i < ADMOB_MAX_ADS; ++i)
+        if( g_AdMob->m_DestroyedAds )
+            DeleteDestroyedAds();
+
+        if( g_AdMob->m_AnchoredViews )
+            UpdateAnchors();
+
+        if( g_AdMob->m_ChangedViews )
+            ApplyViewStates();
+
+        AdMobExtension::AnalyticsUpdate();
+
+        // The steady state (no events) must not allocate
+        allocations = AdMobExtension::GetThreadAllocationCount() - allocations;
+        if( allocations )
         {
-            ::AdMobAd* ad = &g_AdMob->m_Ads[i];
-            if( ad->m_DelayedDelete )
+            AdMobExtension::ProfileAddCount(AdMobExtension::PROFILE_COUNTER_UPDATE_ALLOCATIONS, allocations);
+            if( idle )
             {
-                ad->Delete();
+                AdMobExtension::ProfileAddCount(AdMobExtension::PROFILE_COUNTER_IDLE_FRAME_ALLOCATIONS, allocations);
+                if( !g_AdMob->m_IdleAllocationsLogged )
+                {
+                    g_AdMob->m_IdleAllocationsLogged = true;
+                    dmLogError("%d allocations in an update without any events (the next ones are only counted in idle_frame_allocations)", allocations);
+                }
             }
         }
     }
@@ -1078,67 +2622,62 @@ static dmExtension::Result UpdateExtension(dmExtension::Params* params)
 
 static void OnEventExtension(dmExtension::Params* params, const dmExtension::Event* event)
 {
+    (void)params;
     if( !g_AdMob )
         return;
 
     if( event->m_Event == dmExtension::EVENT_ID_ACTIVATEAPP )
     {
-        g_AdMob->m_CoveringUIAd = -1;
-
-        if(g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER].m_BannerView)
-            g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER].m_BannerView->Resume();
-        if(g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER].m_NativeExpressAdView)
-            g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER].m_NativeExpressAdView->Resume();
-
-        firebase::admob::rewarded_video::Resume();
+        dmAtomicStore32(&g_AdMob->m_CoveringUIAd, -1);
+        SetBackground(false);
     }
     else if(event->m_Event == dmExtension::EVENT_ID_DEACTIVATEAPP)
     {
-        if( g_AdMob->m_CoveringUIAd != -1 )
+        if( dmAtomicGet32(&g_AdMob->m_CoveringUIAd) != -1 )
         {
             AdMobExtension::FlushCommandQueue();
         }
-
-        if(g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER].m_BannerView)
-            g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER].m_BannerView->Pause();
-        if(g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER].m_NativeExpressAdView)
-            g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER].m_NativeExpressAdView->Pause();
-
-        firebase::admob::rewarded_video::Pause();
+        SetBackground(true);
     }
 }
 
-#else // DM_PLATFORM_IOS
+#else // DM_PLATFORM_IOS || DM_PLATFORM_ANDROID || ADMOB_FAKE_BACKEND
 
 
 static dmExtension::Result AppInitializeExtension(dmExtension::AppParams* params)
 {
+    (void)params;
     dmLogWarning("Registered %s (null) Extension\n", MODULE_NAME);
     return dmExtension::RESULT_OK;
 }
 
 static dmExtension::Result InitializeExtension(dmExtension::Params* params)
 {
+    (void)params;
     return dmExtension::RESULT_OK;
 }
 
 static dmExtension::Result AppFinalizeExtension(dmExtension::AppParams* params)
 {
+    (void)params;
     return dmExtension::RESULT_OK;
 }
 
 static dmExtension::Result FinalizeExtension(dmExtension::Params* params)
 {
+    (void)params;
     return dmExtension::RESULT_OK;
 }
 
 static dmExtension::Result UpdateExtension(dmExtension::Params* params)
 {
+    (void)params;
     return dmExtension::RESULT_OK;
 }
 
 static void OnEventExtension(dmExtension::Params* params, const dmExtension::Event* event)
 {
+    (void)params; (void)event;
 }
 
 #endif
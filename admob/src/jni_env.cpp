@@ -0,0 +1,51 @@
+#if defined(DM_PLATFORM_ANDROID)
+
+#include "jni_env.h"
+#include "profile.h"
+
+#include <dmsdk/sdk.h>
+#include <pthread.h>
+
+namespace AdMobExtension {
+
+static pthread_key_t    g_DetachKey;
+static pthread_once_t   g_DetachKeyOnce = PTHREAD_ONCE_INIT;
+static __thread JNIEnv* g_ThreadEnv = 0;
+
+static void DetachThread(void* env)
+{
+    (void)env;
+    dmGraphics::GetNativeAndroidJavaVM()->DetachCurrentThread();
+}
+
+static void CreateDetachKey()
+{
+    pthread_key_create(&g_DetachKey, DetachThread);
+}
+
+JNIEnv* GetJNIEnv()
+{
+    if( g_ThreadEnv )
+        return g_ThreadEnv;
+
+    JavaVM* vm = dmGraphics::GetNativeAndroidJavaVM();
+    JNIEnv* env = 0;
+    if( vm->GetEnv((void**)&env, JNI_VERSION_1_6) == JNI_OK )
+    {
+        // Already attached by someone else (e.g. the engine's main thread), who also detaches it
+        g_ThreadEnv = env;
+        return env;
+    }
+
+    vm->AttachCurrentThread(&env, NULL);
+    ProfileAddCount(PROFILE_COUNTER_JNI_ATTACHES, 1);
+
+    pthread_once(&g_DetachKeyOnce, CreateDetachKey);
+    pthread_setspecific(g_DetachKey, env); // The destructor is only called for non null values
+    g_ThreadEnv = env;
+    return env;
+}
+
+}
+
+#endif
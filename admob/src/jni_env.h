@@ -0,0 +1,15 @@
+#pragma once
+
+#if defined(DM_PLATFORM_ANDROID)
+
+#include <jni.h>
+
+namespace AdMobExtension {
+
+// Returns the JNIEnv of the calling thread, attaching the thread to the Java VM the first time.
+// Threads attached here are detached when they exit.
+JNIEnv* GetJNIEnv();
+
+}
+
+#endif
@@ -0,0 +1,194 @@
+#include "journal.h"
+#include "alloc.h"
+
+#include <dmsdk/dlib/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace AdMobExtension {
+
+static const uint32_t JOURNAL_MAGIC     = 0x4A4D4441; // "ADMJ"
+static const uint32_t JOURNAL_VERSION   = 2;
+
+static_assert(sizeof(JournalRecord) == 128, "The record size is part of the file format");
+
+struct JournalHeader
+{
+    uint32_t m_Magic;
+    uint32_t m_Version;
+    uint32_t m_RecordSize;
+    uint32_t m_Count;
+};
+
+struct Journal
+{
+    JournalRecord*  m_Records;
+    uint32_t        m_Capacity;
+    uint32_t        m_Head;     // The next record to write
+    uint32_t        m_Count;
+};
+
+static Journal g_Journal;
+
+void JournalInit(uint32_t capacity)
+{
+    memset(&g_Journal, 0, sizeof(g_Journal));
+    if( capacity == 0 )
+        return;
+    g_Journal.m_Records = (JournalRecord*)Malloc(sizeof(JournalRecord) * capacity);
+    if( !g_Journal.m_Records )
+    {
+        dmLogError("Could not allocate a journal of %u records", capacity);
+        return;
+    }
+    g_Journal.m_Capacity = capacity;
+}
+
+void JournalFinalize()
+{
+    Free(g_Journal.m_Records);
+    memset(&g_Journal, 0, sizeof(g_Journal));
+}
+
+bool JournalIsEnabled()
+{
+    return g_Journal.m_Capacity != 0;
+}
+
+// Returns the copied length
+static uint8_t CopyString(char* dst, uint32_t size, const char* src, bool* truncated)
+{
+    size_t len = strlen(src);
+    *truncated = len > size;
+    if( *truncated )
+        len = size;
+    memcpy(dst, src, len);
+    return (uint8_t)len;
+}
+
+void JournalAppend(uint64_t queue_time, int id, int type, const char* ad_unit, int message, int firebase_result, const char* firebase_message,
+                    float reward, const int* box, bool has_post_fn)
+{
+    if( g_Journal.m_Capacity == 0 )
+        return;
+
+    JournalRecord* record = &g_Journal.m_Records[g_Journal.m_Head];
+    memset(record, 0, sizeof(*record));
+    record->m_QueueTime = queue_time;
+    record->m_FlushTime = dmTime::GetTime();
+    record->m_Id = id;
+    record->m_Message = message;
+    record->m_FirebaseResult = firebase_result;
+    record->m_Reward = reward;
+    record->m_Type = type;
+    record->m_Flags = has_post_fn ? JOURNAL_FLAG_POSTFN : 0;
+
+    bool truncated;
+    if( firebase_message )
+    {
+        record->m_MessageLength = CopyString(record->m_FirebaseMessage, sizeof(record->m_FirebaseMessage), firebase_message, &truncated);
+        if( truncated )
+            record->m_Flags |= JOURNAL_FLAG_TRUNCATED;
+    }
+    if( ad_unit )
+    {
+        record->m_AdUnitLength = CopyString(record->m_AdUnit, sizeof(record->m_AdUnit), ad_unit, &truncated);
+        if( truncated )
+            record->m_Flags |= JOURNAL_FLAG_AD_UNIT_TRUNCATED;
+    }
+    if( box )
+    {
+        memcpy(record->m_Box, box, sizeof(record->m_Box));
+        record->m_Flags |= JOURNAL_FLAG_BOX;
+    }
+
+    g_Journal.m_Head = (g_Journal.m_Head + 1) % g_Journal.m_Capacity;
+    if( g_Journal.m_Count < g_Journal.m_Capacity )
+        g_Journal.m_Count++;
+}
+
+bool JournalSave(const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if( !file )
+    {
+        dmLogError("Could not open '%s' for writing", path);
+        return false;
+    }
+
+    JournalHeader header;
+    header.m_Magic = JOURNAL_MAGIC;
+    header.m_Version = JOURNAL_VERSION;
+    header.m_RecordSize = sizeof(JournalRecord);
+    header.m_Count = g_Journal.m_Count;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    // Oldest record first
+    uint32_t start = (g_Journal.m_Head + g_Journal.m_Capacity - g_Journal.m_Count) % (g_Journal.m_Capacity ? g_Journal.m_Capacity : 1);
+    for( uint32_t i = 0; ok && i < g_Journal.m_Count; ++i)
+    {
+        ok = fwrite(&g_Journal.m_Records[(start + i) % g_Journal.m_Capacity], sizeof(JournalRecord), 1, file) == 1;
+    }
+    fclose(file);
+
+    if( !ok )
+        dmLogError("Failed to write journal to '%s'", path);
+    return ok;
+}
+
+JournalRecord* JournalLoad(const char* path, uint32_t* count)
+{
+    *count = 0;
+    FILE* file = fopen(path, "rb");
+    if( !file )
+    {
+        dmLogError("Could not open '%s' for reading", path);
+        return 0;
+    }
+
+    JournalHeader header;
+    if( fread(&header, sizeof(header), 1, file) != 1 || header.m_Magic != JOURNAL_MAGIC ||
+        header.m_Version != JOURNAL_VERSION || header.m_RecordSize != sizeof(JournalRecord) )
+    {
+        dmLogError("'%s' is not a valid journal file", path);
+        fclose(file);
+        return 0;
+    }
+
+    // The count isn't trusted, the file holds at most this many records
+    long start = ftell(file);
+    fseek(file, 0, SEEK_END);
+    long end = ftell(file);
+    fseek(file, start, SEEK_SET);
+    uint32_t available = start >= 0 && end > start ? (uint32_t)((end - start) / sizeof(JournalRecord)) : 0;
+    uint32_t capacity = header.m_Count < available ? header.m_Count : available;
+
+    JournalRecord* records = (JournalRecord*)Malloc(sizeof(JournalRecord) * (capacity ? capacity : 1));
+    if( !records )
+    {
+        dmLogError("Could not allocate %u journal records", capacity);
+        fclose(file);
+        return 0;
+    }
+    uint32_t read = (uint32_t)fread(records, sizeof(JournalRecord), capacity, file);
+    fclose(file);
+
+    if( read != header.m_Count )
+        dmLogWarning("Journal '%s' is truncated: read %u of %u records", path, read, header.m_Count);
+
+    *count = read;
+    return records;
+}
+
+const char* JournalGetString(const char* string, uint32_t length, char* buffer, uint32_t size)
+{
+    if( length > size - 1 )
+        length = size - 1;
+    memcpy(buffer, string, length);
+    buffer[length] = 0;
+    return buffer;
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <dmsdk/sdk.h>
+
+namespace AdMobExtension {
+
+enum JournalFlags
+{
+    JOURNAL_FLAG_POSTFN     = 1, // The command had a post function (e.g. it unloaded the ad)
+    JOURNAL_FLAG_TRUNCATED  = 2, // The firebase message didn't fit in the record
+    JOURNAL_FLAG_BOX        = 4, // m_Box is set (a layout message)
+    JOURNAL_FLAG_AD_UNIT_TRUNCATED = 8,
+};
+
+// A fixed size (128 bytes) record of a processed message command.
+// It holds what the Lua callback got, so that it can be replayed without the ads
+struct JournalRecord
+{
+    uint64_t    m_QueueTime;            // When the command was queued (dmTime::GetTime())
+    uint64_t    m_FlushTime;            // When the command was delivered to Lua
+    int32_t     m_Id;
+    int32_t     m_Message;
+    int32_t     m_FirebaseResult;
+    float       m_Reward;
+    int32_t     m_Type;                 // AdMobAdType
+    int32_t     m_Box[4];               // x, y, width, height
+    uint8_t     m_Flags;
+    uint8_t     m_MessageLength;
+    uint8_t     m_AdUnitLength;
+    uint8_t     m_Reserved;
+    char        m_FirebaseMessage[32];  // Firebase error message or reward type, not null terminated
+    char        m_AdUnit[40];           // Not null terminated
+};
+
+// A capacity of 0 disables the journal
+void JournalInit(uint32_t capacity);
+void JournalFinalize();
+bool JournalIsEnabled();
+
+// Appends a record to the ring buffer, overwriting the oldest one if full. Main thread only.
+// The box (x, y, width, height) may be 0
+void JournalAppend(uint64_t queue_time, int id, int type, const char* ad_unit, int message, int firebase_result, const char* firebase_message,
+                    float reward, const int* box, bool has_post_fn);
+
+// Writes the records, oldest first, to a binary file
+bool JournalSave(const char* path);
+
+// Reads a journal file. The returned array is freed with AdMobExtension::Free()
+JournalRecord* JournalLoad(const char* path, uint32_t* count);
+
+// Copies a (not null terminated) string of the record to a buffer of at least 'size' bytes, and null terminates it
+const char* JournalGetString(const char* string, uint32_t length, char* buffer, uint32_t size);
+
+}
@@ -7,13 +7,73 @@ typedef void (*PostCommandFn)(int id);
 extern void QueueCommand(int id, int message, int firebase_result, const char* firebase_message, PostCommandFn fn);
 extern void QueueRewardCommand(int id, int message, float reward, const char* reward_type);
 
+// Returns true for the first ad covering the UI (the state change may be triggered several times, from different threads)
+static bool SetCoveringAd(int32_atomic_t* covering_ad_id, int id)
+{
+    return dmAtomicCompareStore32(covering_ad_id, id, -1) == -1;
+}
+
+// A sequence lock: the box is written between two increments of m_Version, and the reader retries if it changed
+void ResetBoundingBox(BoundingBoxCache* cache)
+{
+    dmAtomicStore32(&cache->m_Version, 0);
+}
+
+bool SetBoundingBox(BoundingBoxCache* cache, const firebase::admob::BoundingBox& box)
+{
+    int32_t version;
+    for(;;)
+    {
+        version = dmAtomicGet32(&cache->m_Version);
+        if( (version & 1) == 0 && dmAtomicCompareStore32(&cache->m_Version, version + 1, version) == version )
+            break;
+    }
+
+    bool changed = version == 0 || dmAtomicGet32(&cache->m_X) != box.x || dmAtomicGet32(&cache->m_Y) != box.y ||
+                    dmAtomicGet32(&cache->m_Width) != box.width || dmAtomicGet32(&cache->m_Height) != box.height;
+    dmAtomicStore32(&cache->m_X, box.x);
+    dmAtomicStore32(&cache->m_Y, box.y);
+    dmAtomicStore32(&cache->m_Width, box.width);
+    dmAtomicStore32(&cache->m_Height, box.height);
+
+    dmAtomicStore32(&cache->m_Version, version + 2);
+    return changed;
+}
+
+bool GetBoundingBox(BoundingBoxCache* cache, firebase::admob::BoundingBox* box)
+{
+    for(;;)
+    {
+        int32_t version = dmAtomicGet32(&cache->m_Version);
+        if( version == 0 )
+            return false;
+        if( version & 1 )
+            continue;
+        box->x = dmAtomicGet32(&cache->m_X);
+        box->y = dmAtomicGet32(&cache->m_Y);
+        box->width = dmAtomicGet32(&cache->m_Width);
+        box->height = dmAtomicGet32(&cache->m_Height);
+        if( dmAtomicGet32(&cache->m_Version) == version )
+            return true;
+    }
+}
+
+void BannerViewListener::OnBoundingBoxChanged(firebase::admob::BannerView* banner_view, firebase::admob::BoundingBox box)
+{
+    (void)banner_view;
+    if( SetBoundingBox(m_Bounds, box) )
+    {
+        QueueCommand(m_Id, AdMobExtension::ADMOB_MESSAGE_LAYOUT, 0, 0, 0);
+    }
+}
+
 void BannerViewListener::OnPresentationStateChanged(firebase::admob::BannerView* banner_view, firebase::admob::BannerView::PresentationState state)
 {
+    (void)banner_view;
     if( state == firebase::admob::BannerView::kPresentationStateCoveringUI ) // When clicked
     {
-        if( *m_CoveringAdID == -1 ) // Because the state change gets triggered twice
+        if( SetCoveringAd(m_CoveringAdID, m_Id) ) // Because the state change gets triggered twice
         {
-            *m_CoveringAdID = m_Id;
             QueueCommand(m_Id, AdMobExtension::ADMOB_MESSAGE_APP_LEAVE, 0, 0, 0);
         }
     }
@@ -29,13 +89,13 @@ void BannerViewListener::OnPresentationStateChanged(firebase::admob::BannerView*
 
 void InterstitialAdListener::OnPresentationStateChanged(firebase::admob::InterstitialAd* interstitial_ad, firebase::admob::InterstitialAd::PresentationState state)
 {
+    (void)interstitial_ad;
     // When showing ad, it also leaves the app
     if( state == firebase::admob::InterstitialAd::kPresentationStateCoveringUI )
     {
         QueueCommand(m_Id, AdMobExtension::ADMOB_MESSAGE_SHOW, 0, 0, 0);
-        if(*m_CoveringAdID == -1)
+        if( SetCoveringAd(m_CoveringAdID, m_Id) )
         {
-            *m_CoveringAdID = m_Id;
             QueueCommand(m_Id, AdMobExtension::ADMOB_MESSAGE_APP_LEAVE, 0, 0, 0);
         }
     }
@@ -57,9 +117,8 @@ void RewardedVideoListener::OnPresentationStateChanged(firebase::admob::rewarded
         state == firebase::admob::rewarded_video::kPresentationStateVideoHasStarted )
     {
         QueueCommand(m_Id, AdMobExtension::ADMOB_MESSAGE_SHOW, 0, 0, 0);
-        if(*m_CoveringAdID == -1)
+        if( SetCoveringAd(m_CoveringAdID, m_Id) )
         {
-            *m_CoveringAdID = m_Id;
             QueueCommand(m_Id, AdMobExtension::ADMOB_MESSAGE_APP_LEAVE, 0, 0, 0);
         }
     }
@@ -69,13 +128,22 @@ void RewardedVideoListener::OnPresentationStateChanged(firebase::admob::rewarded
     }
 }
 
+void NativeExpressAdViewListener::OnBoundingBoxChanged(firebase::admob::NativeExpressAdView* ad_view, firebase::admob::BoundingBox box)
+{
+    (void)ad_view;
+    if( SetBoundingBox(m_Bounds, box) )
+    {
+        QueueCommand(m_Id, AdMobExtension::ADMOB_MESSAGE_LAYOUT, 0, 0, 0);
+    }
+}
+
 void NativeExpressAdViewListener::OnPresentationStateChanged(firebase::admob::NativeExpressAdView* ad_view, firebase::admob::NativeExpressAdView::PresentationState state)
 {
+    (void)ad_view;
     if( state == firebase::admob::NativeExpressAdView::kPresentationStateCoveringUI ) // When clicked
     {
-        if( *m_CoveringAdID == -1 ) // Because the state change gets triggered twice
+        if( SetCoveringAd(m_CoveringAdID, m_Id) ) // Because the state change gets triggered twice
         {
-            *m_CoveringAdID = m_Id;
             QueueCommand(m_Id, AdMobExtension::ADMOB_MESSAGE_APP_LEAVE, 0, 0, 0);
         }
     }
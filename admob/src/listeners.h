@@ -1,5 +1,7 @@
 #pragma once
 
+#include <dmsdk/dlib/atomic.h>
+
 #include "firebase/admob.h"
 #include "firebase/admob/banner_view.h"
 #include "firebase/admob/interstitial_ad.h"
@@ -8,27 +10,41 @@
 
 namespace AdMobExtension {
 
+// The latest bounding box of a banner type view. Written from the listener threads, read on the main thread
+struct BoundingBoxCache
+{
+    int32_atomic_t  m_Version;      // Odd while the box is written, 0 if there is no box yet
+    int32_atomic_t  m_X;
+    int32_atomic_t  m_Y;
+    int32_atomic_t  m_Width;
+    int32_atomic_t  m_Height;
+};
+
+void ResetBoundingBox(BoundingBoxCache* cache);
+// Returns false if the box didn't change
+bool SetBoundingBox(BoundingBoxCache* cache, const firebase::admob::BoundingBox& box);
+// Returns false if there is no box yet
+bool GetBoundingBox(BoundingBoxCache* cache, firebase::admob::BoundingBox* box);
+
 class BannerViewListener : public firebase::admob::BannerView::Listener
 {
 public:
-    BannerViewListener(int* coveringad, int id) : m_CoveringAdID(coveringad), m_Id(id) {}
-    void OnBoundingBoxChanged(firebase::admob::BannerView* banner_view, firebase::admob::BoundingBox box) {
-        (void)banner_view;
-        (void)box;
-    }
+    BannerViewListener(int32_atomic_t* coveringad, BoundingBoxCache* bounds, int id) : m_CoveringAdID(coveringad), m_Bounds(bounds), m_Id(id) {}
+    void OnBoundingBoxChanged(firebase::admob::BannerView* banner_view, firebase::admob::BoundingBox box);
     void OnPresentationStateChanged(firebase::admob::BannerView* banner_view, firebase::admob::BannerView::PresentationState state);
 
-    int*    m_CoveringAdID;
+    int32_atomic_t* m_CoveringAdID;     // Written from the listener threads, see SetCoveringAd()
+    BoundingBoxCache* m_Bounds;
     int     m_Id;       // The internal ad number
 };
 
 class InterstitialAdListener : public firebase::admob::InterstitialAd::Listener
 {
 public:
-    InterstitialAdListener(int* coveringad, int id) : m_CoveringAdID(coveringad), m_Id(id) {}
+    InterstitialAdListener(int32_atomic_t* coveringad, int id) : m_CoveringAdID(coveringad), m_Id(id) {}
     void OnPresentationStateChanged(firebase::admob::InterstitialAd* interstitial_ad, firebase::admob::InterstitialAd::PresentationState state);
 
-    int*    m_CoveringAdID;
+    int32_atomic_t* m_CoveringAdID;     // Written from the listener threads, see SetCoveringAd()
     int m_Id; // The internal ad number
 };
 
@@ -36,24 +52,22 @@ public:
 class NativeExpressAdViewListener : public firebase::admob::NativeExpressAdView::Listener
 {
 public:
-    NativeExpressAdViewListener(int* coveringad, int id) : m_CoveringAdID(coveringad), m_Id(id) {}
-    void OnBoundingBoxChanged(firebase::admob::NativeExpressAdView* ad_view, firebase::admob::BoundingBox box) {
-        (void)ad_view;
-        (void)box;
-    }
+    NativeExpressAdViewListener(int32_atomic_t* coveringad, BoundingBoxCache* bounds, int id) : m_CoveringAdID(coveringad), m_Bounds(bounds), m_Id(id) {}
+    void OnBoundingBoxChanged(firebase::admob::NativeExpressAdView* ad_view, firebase::admob::BoundingBox box);
     void OnPresentationStateChanged(firebase::admob::NativeExpressAdView* ad_view, firebase::admob::NativeExpressAdView::PresentationState state);
-    int*    m_CoveringAdID;
+    int32_atomic_t* m_CoveringAdID;     // Written from the listener threads, see SetCoveringAd()
+    BoundingBoxCache* m_Bounds;
     int     m_Id;       // The internal ad number
 };
 
 class RewardedVideoListener : public firebase::admob::rewarded_video::Listener
 {
 public:
-    RewardedVideoListener(int* coveringad, int id) : m_CoveringAdID(coveringad), m_Id(id) {}
+    RewardedVideoListener(int32_atomic_t* coveringad, int id) : m_CoveringAdID(coveringad), m_Id(id) {}
     void OnRewarded(firebase::admob::rewarded_video::RewardItem reward);
     void OnPresentationStateChanged(firebase::admob::rewarded_video::PresentationState state);
 
-    int*    m_CoveringAdID;
+    int32_atomic_t* m_CoveringAdID;     // Written from the listener threads, see SetCoveringAd()
     int     m_Id;       // The internal ad number
 };
 
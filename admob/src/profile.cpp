@@ -0,0 +1,110 @@
+#include "profile.h"
+#include "alloc.h"
+
+#include <dmsdk/dlib/atomic.h>
+#include <dmsdk/dlib/time.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace AdMobExtension {
+
+static const char* PROFILE_COUNTER_NAMES[PROFILE_COUNTER_MAX] =
+{
+    "queued_commands",
+    "delivered_commands",
+    "ad_request_strings",
+    "load_calls",
+    "message_loaded",
+    "message_failed_to_load",
+    "message_show",
+    "message_hide",
+    "message_reward",
+    "message_app_leave",
+    "message_unloaded",
+    "update_allocations",
+    "idle_frame_allocations",
+    "worker_jobs",
+    "jni_attaches",
+    "recycled_views",
+    "view_calls",
+    "view_call_frames",
+    "timeouts",
+    "dropped_commands",
+    "cancelled_loads",
+    "capped_shows",
+    "config_snapshots",
+    "analytics_events",
+    "dropped_analytics_events",
+};
+
+struct Profile
+{
+    int32_atomic_t      m_Counters[PROFILE_COUNTER_MAX];
+    uint64_t            m_Start;
+    bool                m_Enabled;
+};
+
+static Profile g_Profile;
+
+void ProfileInit(bool enabled)
+{
+    memset(&g_Profile, 0, sizeof(g_Profile));
+    g_Profile.m_Enabled = enabled;
+    g_Profile.m_Start = dmTime::GetTime();
+}
+
+bool ProfileIsEnabled()
+{
+    return g_Profile.m_Enabled;
+}
+
+void ProfileAddCount(ProfileCounter counter, int count)
+{
+    if( !g_Profile.m_Enabled )
+        return;
+    dmAtomicAdd32(&g_Profile.m_Counters[counter], count);
+}
+
+void ProfilePushTable(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    lua_newtable(L);
+
+    lua_pushnumber(L, (dmTime::GetTime() - g_Profile.m_Start) / 1000000.0);
+    lua_setfield(L, -2, "elapsed");
+
+    lua_pushnumber(L, GetAllocationCount());
+    lua_setfield(L, -2, "allocations");
+
+    lua_newtable(L);
+    for( uint32_t i = 0; i < PROFILE_COUNTER_MAX; ++i)
+    {
+        lua_pushnumber(L, dmAtomicGet32(&g_Profile.m_Counters[i]));
+        lua_setfield(L, -2, PROFILE_COUNTER_NAMES[i]);
+    }
+    lua_setfield(L, -2, "counters");
+}
+
+bool ProfileWriteJson(const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if( !file )
+    {
+        dmLogError("Could not open '%s' for writing", path);
+        return false;
+    }
+
+    fprintf(file, "{\n  \"elapsed\": %f,\n  \"allocations\": %d,\n  \"counters\": {\n", (dmTime::GetTime() - g_Profile.m_Start) / 1000000.0, GetAllocationCount());
+    for( uint32_t i = 0; i < PROFILE_COUNTER_MAX; ++i)
+    {
+        fprintf(file, "    \"%s\": %d%s\n", PROFILE_COUNTER_NAMES[i], dmAtomicGet32(&g_Profile.m_Counters[i]), i + 1 < PROFILE_COUNTER_MAX ? "," : "");
+    }
+    fprintf(file, "  }\n}\n");
+
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+}
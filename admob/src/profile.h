@@ -0,0 +1,50 @@
+#pragma once
+
+#include <dmsdk/sdk.h>
+
+namespace AdMobExtension {
+
+// Counters that may be updated from any thread
+enum ProfileCounter
+{
+    PROFILE_COUNTER_QUEUED_COMMANDS,
+    PROFILE_COUNTER_DELIVERED_COMMANDS,
+    PROFILE_COUNTER_AD_REQUEST_STRINGS,     // Keywords, test devices and extras parsed by SetupAdRequest
+    PROFILE_COUNTER_LOAD_CALLS,
+    PROFILE_COUNTER_MESSAGE_LOADED,         // One counter per AdMobEvent
+    PROFILE_COUNTER_MESSAGE_FAILED_TO_LOAD,
+    PROFILE_COUNTER_MESSAGE_SHOW,
+    PROFILE_COUNTER_MESSAGE_HIDE,
+    PROFILE_COUNTER_MESSAGE_REWARD,
+    PROFILE_COUNTER_MESSAGE_APP_LEAVE,
+    PROFILE_COUNTER_MESSAGE_UNLOADED,
+    PROFILE_COUNTER_UPDATE_ALLOCATIONS,     // Allocations made on the main thread during UpdateExtension
+    PROFILE_COUNTER_IDLE_FRAME_ALLOCATIONS, // Allocations made during an UpdateExtension without any events (should be 0)
+    PROFILE_COUNTER_WORKER_JOBS,            // Sdk calls passed to WorkerRun
+    PROFILE_COUNTER_JNI_ATTACHES,           // Threads attached to the Java VM by GetJNIEnv (Android)
+    PROFILE_COUNTER_RECYCLED_VIEWS,         // Loads that reused an initialized view, instead of creating one
+    PROFILE_COUNTER_VIEW_CALLS,             // MoveTo/Show/Hide calls made on the banner type views
+    PROFILE_COUNTER_VIEW_CALL_FRAMES,       // Updates that made any of those calls (at most 2 calls per view and update)
+    PROFILE_COUNTER_TIMEOUTS,               // Sdk calls that didn't complete in time (see CheckTimeouts)
+    PROFILE_COUNTER_DROPPED_COMMANDS,       // Late results of the calls that were timed out, or unloaded
+    PROFILE_COUNTER_CANCELLED_LOADS,        // Ads unloaded before their load finished
+    PROFILE_COUNTER_CAPPED_SHOWS,           // Shows refused by the show cap from Remote Config
+    PROFILE_COUNTER_CONFIG_SNAPSHOTS,       // Remote Config tables built for remote_config.snapshot() (the others were cached)
+    PROFILE_COUNTER_ANALYTICS_EVENTS,       // Ad events logged to Firebase Analytics
+    PROFILE_COUNTER_DROPPED_ANALYTICS_EVENTS,   // Ad events that didn't fit in the batch of the frame
+    PROFILE_COUNTER_MAX,
+};
+
+void ProfileInit(bool enabled);
+bool ProfileIsEnabled();
+
+void ProfileAddCount(ProfileCounter counter, int count);
+
+// Pushes a table with the counters and the total allocation count.
+// The timings of the hot paths are measured by the host benchmark instead (see test/bench.cpp)
+void ProfilePushTable(lua_State* L);
+
+// Writes the same data as a JSON object
+bool ProfileWriteJson(const char* path);
+
+}
@@ -0,0 +1,127 @@
+#include "stats.h"
+
+#include <string.h>
+
+#include "alloc.h"
+#include "enums.h"
+
+namespace AdMobExtension {
+
+static const uint32_t ADMOB_MAX_STATS_ENTRIES = 32;
+
+struct StatsEntry
+{
+    dmhash_t        m_AdUnitHash;
+    char*           m_AdUnit;
+    uint32_t        m_Requests;
+    uint32_t        m_Fills;
+    uint32_t        m_Errors[ADMOB_ERROR_MAX];
+};
+
+struct StatsRegistry
+{
+    StatsEntry      m_Entries[ADMOB_MAX_STATS_ENTRIES];
+    uint32_t        m_Count;
+};
+
+static StatsRegistry g_Stats;
+
+void StatsInit()
+{
+    memset(&g_Stats, 0, sizeof(g_Stats));
+}
+
+void StatsFinalize()
+{
+    uint32_t count = g_Stats.m_Count;
+    for( uint32_t i = 0; i < count; ++i)
+    {
+        Free(g_Stats.m_Entries[i].m_AdUnit);
+    }
+    memset(&g_Stats, 0, sizeof(g_Stats));
+}
+
+int StatsRegisterAdUnit(const char* ad_unit)
+{
+    dmhash_t hash = dmHashString64(ad_unit);
+    uint32_t count = g_Stats.m_Count;
+    for( uint32_t i = 0; i < count; ++i)
+    {
+        if( g_Stats.m_Entries[i].m_AdUnitHash == hash )
+            return (int)i;
+    }
+
+    if( count == ADMOB_MAX_STATS_ENTRIES )
+    {
+        dmLogWarning("Too many ad units for the stats registry (max %u), '%s' will not be tracked", ADMOB_MAX_STATS_ENTRIES, ad_unit);
+        return -1;
+    }
+
+    StatsEntry* entry = &g_Stats.m_Entries[count];
+    memset(entry, 0, sizeof(*entry));
+    entry->m_AdUnitHash = hash;
+    entry->m_AdUnit = StrDup(ad_unit);
+    g_Stats.m_Count = count + 1;
+    return (int)count;
+}
+
+void StatsAddRequest(int index)
+{
+    if( index < 0 )
+        return;
+    g_Stats.m_Entries[index].m_Requests++;
+}
+
+void StatsAddFill(int index)
+{
+    if( index < 0 )
+        return;
+    g_Stats.m_Entries[index].m_Fills++;
+}
+
+void StatsAddError(int index, int error)
+{
+    if( index < 0 )
+        return;
+    if( error < 0 || error >= ADMOB_ERROR_MAX )
+        error = ADMOB_ERROR_INTERNALERROR; // Unknown error codes from the SDK
+    g_Stats.m_Entries[index].m_Errors[error]++;
+}
+
+void StatsPushTable(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    lua_newtable(L);
+
+    uint32_t count = g_Stats.m_Count;
+    for( uint32_t i = 0; i < count; ++i)
+    {
+        StatsEntry* entry = &g_Stats.m_Entries[i];
+        uint32_t requests = entry->m_Requests;
+        uint32_t fills = entry->m_Fills;
+
+        lua_newtable(L);
+
+            lua_pushnumber(L, requests);
+            lua_setfield(L, -2, "requests");
+
+            lua_pushnumber(L, fills);
+            lua_setfield(L, -2, "fills");
+
+            lua_pushnumber(L, requests > 0 ? (lua_Number)fills / (lua_Number)requests : 0);
+            lua_setfield(L, -2, "fill_rate");
+
+            lua_newtable(L);
+            for( int e = ADMOB_ERROR_NONE + 1; e < ADMOB_ERROR_MAX; ++e)
+            {
+                lua_pushnumber(L, entry->m_Errors[e]);
+                lua_rawseti(L, -2, e);
+            }
+            lua_setfield(L, -2, "errors");
+
+        lua_setfield(L, -2, entry->m_AdUnit);
+    }
+}
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <dmsdk/sdk.h>
+
+namespace AdMobExtension {
+
+// Fill rate and error counters, keyed by (interned) ad unit.
+// Main thread only: the loads are counted in LoadFormat(), and the fills and errors when FlushCommandQueue() delivers them.
+
+void StatsInit();
+void StatsFinalize();
+
+// Returns the index of the ad unit entry (creating it if needed), or -1 if the registry is full
+int  StatsRegisterAdUnit(const char* ad_unit);
+
+void StatsAddRequest(int index);
+void StatsAddFill(int index);
+void StatsAddError(int index, int error);
+
+// Pushes a table with a snapshot of all counters: { [ad_unit] = { requests, fills, fill_rate, errors = { [code] = count } } }
+void StatsPushTable(lua_State* L);
+
+}
@@ -0,0 +1,170 @@
+#include "tuning.h"
+
+#include <dmsdk/dlib/atomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+#include <string>
+#include "firebase/remote_config.h"
+#endif
+
+namespace AdMobExtension {
+
+// As in the Lua functions, and the Remote Config keys (e.g. "admob_banner_ad_units")
+static const char* TUNING_FORMAT_NAMES[ADMOB_TYPE_MAX] = { "banner", "interstitial", "rewardedvideo", "nativeexpress" };
+
+static const int32_t TUNING_NEW = 4;    // Set in m_Middle while its snapshot wasn't picked up (the low bits are the index)
+
+// A triple buffer: the writer fills m_Write and swaps it with m_Middle, and the main thread swaps m_Read with m_Middle
+// when it holds a new snapshot. Neither side waits, and a snapshot is never written while it's read.
+struct TuningBuffers
+{
+    Tuning          m_Snapshots[3];
+    int32_atomic_t  m_Middle;
+    int32_t         m_Read;     // Main thread
+    int32_t         m_Write;    // Writer thread
+    uint32_t        m_Version;  // Writer thread
+};
+
+static TuningBuffers g_Tuning;
+
+// A full barrier exchange, so that the snapshot is complete before its index is seen
+static int32_t Exchange(int32_atomic_t* ptr, int32_t value)
+{
+    int32_t old;
+    do {
+        old = dmAtomicGet32(ptr);
+    } while( dmAtomicCompareStore32(ptr, value, old) != old );
+    return old;
+}
+
+void TuningInit()
+{
+    memset(&g_Tuning, 0, sizeof(g_Tuning));
+    g_Tuning.m_Read = 0;
+    g_Tuning.m_Middle = 1;
+    g_Tuning.m_Write = 2;
+}
+
+void TuningFinalize()
+{
+    memset(&g_Tuning, 0, sizeof(g_Tuning));
+}
+
+bool TuningUpdate()
+{
+    if( !(dmAtomicGet32(&g_Tuning.m_Middle) & TUNING_NEW) )
+        return false;
+    g_Tuning.m_Read = Exchange(&g_Tuning.m_Middle, g_Tuning.m_Read) & ~TUNING_NEW;
+    return true;
+}
+
+const Tuning* TuningGet()
+{
+    return &g_Tuning.m_Snapshots[g_Tuning.m_Read];
+}
+
+Tuning* TuningBeginWrite()
+{
+    Tuning* tuning = &g_Tuning.m_Snapshots[g_Tuning.m_Write];
+    memset(tuning, 0, sizeof(*tuning));
+    return tuning;
+}
+
+void TuningEndWrite()
+{
+    g_Tuning.m_Snapshots[g_Tuning.m_Write].m_Version = ++g_Tuning.m_Version;
+    g_Tuning.m_Write = Exchange(&g_Tuning.m_Middle, g_Tuning.m_Write | TUNING_NEW) & ~TUNING_NEW;
+}
+
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+
+// The waterfall is a comma separated list of ad units
+static void ParseAdUnits(const char* s, TuningFormat* format)
+{
+    while( format->m_NumAdUnits < TUNING_MAX_AD_UNITS )
+    {
+        s += strspn(s, ", ");
+        size_t length = strcspn(s, ", ");
+        if( length == 0 )
+            break;
+
+        if( length < TUNING_MAX_AD_UNIT_LENGTH )
+            memcpy(format->m_AdUnits[format->m_NumAdUnits++], s, length); // The snapshot is cleared
+        else
+            dmLogWarning("Remote Config: the ad unit '%.*s' is too long (max %u characters)", (int)length, s, TUNING_MAX_AD_UNIT_LENGTH - 1);
+        s += length;
+    }
+}
+
+static uint32_t GetUnsigned(const char* key)
+{
+    int64_t value = firebase::remote_config::GetLong(key);
+    if( value <= 0 )
+        return 0;
+    return value > 0x7fffffff ? 0x7fffffff : (uint32_t)value;
+}
+
+void TuningActivateRemoteConfig()
+{
+    // Returns false if nothing new was fetched, the values activated before (e.g. in an earlier session) are read anyway
+    firebase::remote_config::ActivateFetched();
+
+    Tuning* tuning = TuningBeginWrite();
+    char key[64];
+    for( uint32_t i = 0; i < ADMOB_TYPE_MAX; ++i )
+    {
+        TuningFormat* format = &tuning->m_Formats[i];
+
+        snprintf(key, sizeof(key), "admob_%s_ad_units", TUNING_FORMAT_NAMES[i]);
+        std::string ad_units = firebase::remote_config::GetString(key);
+        ParseAdUnits(ad_units.c_str(), format);
+
+        snprintf(key, sizeof(key), "admob_%s_refresh_interval", TUNING_FORMAT_NAMES[i]);
+        format->m_RefreshInterval = GetUnsigned(key);
+
+        snprintf(key, sizeof(key), "admob_%s_show_cap", TUNING_FORMAT_NAMES[i]);
+        format->m_ShowCap = GetUnsigned(key);
+    }
+    TuningEndWrite();
+}
+
+#endif
+
+void TuningPushTable(lua_State* L)
+{
+    DM_LUA_STACK_CHECK(L, 1);
+
+    const Tuning* tuning = TuningGet();
+
+    lua_newtable(L);
+
+    lua_pushnumber(L, tuning->m_Version);
+    lua_setfield(L, -2, "version");
+
+    for( uint32_t i = 0; i < ADMOB_TYPE_MAX; ++i )
+    {
+        const TuningFormat* format = &tuning->m_Formats[i];
+
+        lua_newtable(L);
+
+            lua_newtable(L);
+            for( uint32_t u = 0; u < format->m_NumAdUnits; ++u )
+            {
+                lua_pushstring(L, format->m_AdUnits[u]);
+                lua_rawseti(L, -2, u + 1);
+            }
+            lua_setfield(L, -2, "ad_units");
+
+            lua_pushnumber(L, format->m_RefreshInterval);
+            lua_setfield(L, -2, "refresh_interval");
+
+            lua_pushnumber(L, format->m_ShowCap);
+            lua_setfield(L, -2, "show_cap");
+
+        lua_setfield(L, -2, TUNING_FORMAT_NAMES[i]);
+    }
+}
+
+}
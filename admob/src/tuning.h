@@ -0,0 +1,53 @@
+#pragma once
+
+#include <dmsdk/sdk.h>
+
+#include "firebase/admob/banner_view.h"
+#include "enums.h"
+#include "firebase_modules.h"
+
+namespace AdMobExtension {
+
+// The ad tuning controlled from Remote Config: the ad units (in waterfall order), refresh intervals and show caps per ad format.
+// After each activation, the values are copied into a flat snapshot, which is swapped in atomically for the main thread.
+// The main thread then only reads plain fields, and never calls the sdk (JNI on Android) for them.
+
+static const uint32_t TUNING_MAX_AD_UNITS = 4;          // The length of a waterfall
+static const uint32_t TUNING_MAX_AD_UNIT_LENGTH = 64;
+
+struct TuningFormat
+{
+    char        m_AdUnits[TUNING_MAX_AD_UNITS][TUNING_MAX_AD_UNIT_LENGTH];  // Tried in order, as long as there is no fill
+    uint32_t    m_NumAdUnits;
+    uint32_t    m_RefreshInterval;  // Seconds, 0 if not set
+    uint32_t    m_ShowCap;          // Shows per session, 0 if unlimited
+};
+
+struct Tuning
+{
+    uint32_t        m_Version;      // 0 until the first snapshot was made
+    TuningFormat    m_Formats[ADMOB_TYPE_MAX];
+};
+
+void TuningInit();
+void TuningFinalize();
+
+// Swaps in the latest snapshot. Main thread. Returns true if it changed
+bool TuningUpdate();
+
+// The current snapshot. Main thread, valid until the next TuningUpdate()
+const Tuning* TuningGet();
+
+// Returns the snapshot to fill (cleared), and publishes it. Only one thread may write at a time (e.g. the worker thread)
+Tuning* TuningBeginWrite();
+void TuningEndWrite();
+
+#if defined(ADMOB_WITH_REMOTE_CONFIG)
+// Activates the fetched values, and publishes a snapshot of them. Runs on the worker thread (if enabled)
+void TuningActivateRemoteConfig();
+#endif
+
+// Pushes a table with the current snapshot: { version, [format] = { ad_units = {...}, refresh_interval, show_cap } }
+void TuningPushTable(lua_State* L);
+
+}
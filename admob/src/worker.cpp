@@ -0,0 +1,157 @@
+#include "worker.h"
+#include "alloc.h"
+#include "jni_env.h"
+#include "profile.h"
+
+#include <dmsdk/sdk.h>
+#include <dmsdk/dlib/condition_variable.h>
+#include <dmsdk/dlib/mutex.h>
+#include <dmsdk/dlib/thread.h>
+
+namespace AdMobExtension {
+
+struct WorkerJob
+{
+    WorkerFn    m_Fn;
+    int         m_Id;
+    uint32_t    m_Group;
+};
+
+struct Worker
+{
+    dmArray<WorkerJob>                      m_Jobs;
+    dmMutex::HMutex                         m_Mutex;
+    dmConditionVariable::HConditionVariable m_JobAvailable;
+    dmConditionVariable::HConditionVariable m_JobsDone;
+    dmThread::Thread                        m_Thread;
+    uint32_t                                m_Running;  // Jobs currently being run (0 or 1)
+    uint32_t                                m_RunningGroup;
+    bool                                    m_Threaded;
+    bool                                    m_Quit;
+};
+
+static Worker g_Worker;
+
+static void WorkerThread(void* arg)
+{
+    (void)arg;
+#if defined(DM_PLATFORM_ANDROID)
+    GetJNIEnv(); // Attach once, the sdk calls on this thread reuse the attachment
+#endif
+    while( true )
+    {
+        WorkerJob job;
+        {
+            DM_MUTEX_SCOPED_LOCK(g_Worker.m_Mutex);
+            while( g_Worker.m_Jobs.Empty() && !g_Worker.m_Quit )
+            {
+                dmConditionVariable::Wait(g_Worker.m_JobAvailable, g_Worker.m_Mutex);
+            }
+            if( g_Worker.m_Jobs.Empty() )
+                return;
+
+            // Few jobs are queued at once, so keep the order by shifting them
+            job = g_Worker.m_Jobs[0];
+            uint32_t size = g_Worker.m_Jobs.Size();
+            for( uint32_t i = 1; i < size; ++i )
+                g_Worker.m_Jobs[i-1] = g_Worker.m_Jobs[i];
+            g_Worker.m_Jobs.SetSize(size - 1);
+            g_Worker.m_Running = 1;
+            g_Worker.m_RunningGroup = job.m_Group;
+        }
+
+        job.m_Fn(job.m_Id);
+
+        {
+            DM_MUTEX_SCOPED_LOCK(g_Worker.m_Mutex);
+            g_Worker.m_Running = 0;
+            dmConditionVariable::Broadcast(g_Worker.m_JobsDone);
+        }
+    }
+}
+
+void WorkerInit(bool threaded)
+{
+    g_Worker.m_Threaded = threaded;
+    g_Worker.m_Quit = false;
+    g_Worker.m_Running = 0;
+    if( !threaded )
+        return;
+
+    g_Worker.m_Jobs.SetCapacity(8);
+    g_Worker.m_Mutex = dmMutex::New();
+    g_Worker.m_JobAvailable = dmConditionVariable::New();
+    g_Worker.m_JobsDone = dmConditionVariable::New();
+    g_Worker.m_Thread = dmThread::New(WorkerThread, 0x10000, 0, "admob_worker");
+}
+
+void WorkerFinalize()
+{
+    if( !g_Worker.m_Threaded )
+        return;
+
+    {
+        DM_MUTEX_SCOPED_LOCK(g_Worker.m_Mutex);
+        g_Worker.m_Quit = true;
+        dmConditionVariable::Signal(g_Worker.m_JobAvailable);
+    }
+    dmThread::Join(g_Worker.m_Thread);
+
+    dmConditionVariable::Delete(g_Worker.m_JobsDone);
+    dmConditionVariable::Delete(g_Worker.m_JobAvailable);
+    dmMutex::Delete(g_Worker.m_Mutex);
+    g_Worker.m_Jobs.SetCapacity(0);
+    g_Worker.m_Threaded = false;
+}
+
+bool WorkerIsThreaded()
+{
+    return g_Worker.m_Threaded;
+}
+
+void WorkerRun(WorkerFn fn, int id, uint32_t group)
+{
+    ProfileAddCount(PROFILE_COUNTER_WORKER_JOBS, 1);
+
+    if( !g_Worker.m_Threaded )
+    {
+        fn(id);
+        return;
+    }
+
+    WorkerJob job;
+    job.m_Fn = fn;
+    job.m_Id = id;
+    job.m_Group = group;
+
+    DM_MUTEX_SCOPED_LOCK(g_Worker.m_Mutex);
+    if( g_Worker.m_Jobs.Full() )
+    {
+        CountAllocation();
+        g_Worker.m_Jobs.OffsetCapacity(8);
+    }
+    g_Worker.m_Jobs.Push(job);
+    dmConditionVariable::Signal(g_Worker.m_JobAvailable);
+}
+
+void WorkerCancel(uint32_t group)
+{
+    if( !g_Worker.m_Threaded )
+        return;
+
+    DM_MUTEX_SCOPED_LOCK(g_Worker.m_Mutex);
+    uint32_t size = 0;
+    for( uint32_t i = 0; i < g_Worker.m_Jobs.Size(); ++i )
+    {
+        if( g_Worker.m_Jobs[i].m_Group != group )
+            g_Worker.m_Jobs[size++] = g_Worker.m_Jobs[i];
+    }
+    g_Worker.m_Jobs.SetSize(size);
+
+    while( g_Worker.m_Running && g_Worker.m_RunningGroup == group )
+    {
+        dmConditionVariable::Wait(g_Worker.m_JobsDone, g_Worker.m_Mutex);
+    }
+}
+
+}
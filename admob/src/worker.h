@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace AdMobExtension {
+
+// Runs the blocking sdk calls (initialize and load the ads) on a separate thread.
+// The jobs are run in order, and report back through the command queue (via the Firebase callbacks)
+
+typedef void (*WorkerFn)(int id);
+
+// The jobs of a group (e.g. of one ad) can be cancelled together
+const uint32_t WORKER_GROUP_NONE = 0;
+
+// If not threaded, the jobs are run directly on the calling thread
+void WorkerInit(bool threaded);
+void WorkerFinalize();
+bool WorkerIsThreaded();
+
+void WorkerRun(WorkerFn fn, int id, uint32_t group);
+
+// Removes the queued jobs of the group, and blocks while one of its jobs is running (e.g. before deleting the ad the jobs refer to).
+// The jobs of the other groups are not waited for
+void WorkerCancel(uint32_t group);
+
+}
@@ -0,0 +1,180 @@
+// Counts every malloc (of all threads: the extension, the fake backend and the engine stand-ins),
+// to check that the update doesn't allocate when idle, and that the events and the ad lifecycles
+// allocate a bounded amount (and free all of it).
+// Usage: alloc_test
+
+#include "../src/googlemobileads.cpp"
+
+#include "host.h"
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void  __libc_free(void* ptr);
+
+static int32_atomic_t g_Mallocs = 0;
+static int32_atomic_t g_Frees = 0;
+
+extern "C" void* malloc(size_t size)
+{
+    __atomic_add_fetch(&g_Mallocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+    __atomic_add_fetch(&g_Mallocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    __atomic_add_fetch(&g_Mallocs, 1, __ATOMIC_RELAXED);
+    if( ptr )
+        __atomic_add_fetch(&g_Frees, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void* ptr)
+{
+    if( ptr )
+        __atomic_add_fetch(&g_Frees, 1, __ATOMIC_RELAXED);
+    __libc_free(ptr);
+}
+
+using namespace AdMobTest;
+
+static const uint64_t TEST_TIMEOUT = 10000000; // 10s
+
+static int GetMallocs()
+{
+    return __atomic_load_n(&g_Mallocs, __ATOMIC_SEQ_CST);
+}
+
+static int GetFrees()
+{
+    return __atomic_load_n(&g_Frees, __ATOMIC_SEQ_CST);
+}
+
+// Lets the callback and worker threads finish what they were doing
+static void Settle()
+{
+    for( uint32_t i = 0; i < 20; ++i )
+    {
+        HostUpdate(1);
+        dmTime::Sleep(1000);
+    }
+}
+
+// Delivers 'count' reward events to the interstitial's callback, returns the mallocs it took
+static int QueueEvents(uint32_t count, const char* reward_type)
+{
+    HOST_CHECK(HostRun("count = 0"));
+    int mallocs = GetMallocs();
+    for( uint32_t i = 0; i < count; ++i )
+        AdMobExtension::QueueCommand(AdMobExtension::ADMOB_TYPE_INTERSTITIAL, AdMobExtension::ADMOB_MESSAGE_REWARD, 0, reward_type, 0);
+    HostUpdate(1);
+    mallocs = GetMallocs() - mallocs;
+    HOST_CHECK(HostGetNumber("count") == count);
+    return mallocs;
+}
+
+static void TestIdleUpdate()
+{
+    HOST_CHECK(HostRun("loaded = false; admob.load_banner('test', {}, on_ad)"));
+    HOST_CHECK(HostUpdateUntil("loaded", TEST_TIMEOUT));
+    HOST_CHECK(HostRun("loaded = false; admob.load_interstitial('test', { keywords = { 'a', 'b' }, extras = { k = 'v' } }, on_ad)"));
+    HOST_CHECK(HostUpdateUntil("loaded", TEST_TIMEOUT));
+    HOST_CHECK(HostRun("admob.show_banner(); admob.move_banner(1)"));
+    Settle();
+
+    int mallocs = GetMallocs();
+    HostUpdate(10000);
+    mallocs = GetMallocs() - mallocs;
+    printf("idle updates: %d mallocs in 10000 updates\n", mallocs);
+    HOST_CHECK(mallocs == 0);
+}
+
+static void TestEvents()
+{
+    const uint32_t count = 4096;
+
+    // The queues grow by 8 commands at a time, and are swapped on each flush: once both have grown, nothing is allocated
+    int cold = QueueEvents(count, "coins");
+    QueueEvents(count, "coins");
+    int warm = QueueEvents(count, "coins");
+    // A message that doesn't fit in the command is copied
+    int long_message = QueueEvents(count, "a reward type that is too long to be stored in the command itself");
+
+    printf("events: %d mallocs for %u events (cold), %d (warm), %d (long messages)\n", cold, count, warm, long_message);
+    HOST_CHECK(cold <= (int)(count / 8) + 1);
+    HOST_CHECK(warm == 0);
+    HOST_CHECK(long_message == (int)count);
+}
+
+static void LoadUnload()
+{
+    HOST_CHECK(HostRun("loaded = false; unloaded = false; admob.load_interstitial('test', { keywords = { 'a', 'b' }, extras = { k = 'v' } }, on_ad)"));
+    HOST_CHECK(HostUpdateUntil("loaded", TEST_TIMEOUT));
+    HOST_CHECK(HostRun("admob.unload_interstitial()"));
+    HOST_CHECK(HostUpdateUntil("unloaded", TEST_TIMEOUT));
+}
+
+static void TestLoadUnload()
+{
+    const uint32_t cycles = 200;
+    const int max_mallocs_per_cycle = 12; // 10 at the time of writing (9 by the extension, 1 by the fake sdk)
+
+    HOST_CHECK(HostRun("unloaded = false; admob.unload_interstitial()"));
+    HOST_CHECK(HostUpdateUntil("unloaded", TEST_TIMEOUT));
+    for( uint32_t i = 0; i < 8; ++i )
+        LoadUnload();
+    Settle();
+
+    int mallocs = GetMallocs();
+    int frees = GetFrees();
+    int extension = AdMobExtension::GetAllocationCount();
+    for( uint32_t i = 0; i < cycles; ++i )
+        LoadUnload();
+    Settle();
+    mallocs = GetMallocs() - mallocs;
+    frees = GetFrees() - frees;
+    extension = AdMobExtension::GetAllocationCount() - extension;
+
+    printf("load/unload: %.1f mallocs per cycle (%.1f by the extension), %d not freed after %u cycles\n",
+                mallocs / (float)cycles, extension / (float)cycles, mallocs - frees, cycles);
+    HOST_CHECK(mallocs <= max_mallocs_per_cycle * (int)cycles);
+    HOST_CHECK(mallocs == frees);
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc; (void)argv;
+    HostSetConfig("admob.fake_fill_rate", "1");
+    HostSetConfig("admob.fake_latency_min", "0");
+    HostSetConfig("admob.fake_latency_max", "0");
+    HostSetConfig("admob.fake_latency_tail_rate", "0");
+    HostSetConfig("admob.worker_thread", "1");
+    HostSetConfig("admob.journal_size", "256");
+    HostSetConfig("admob.profile", "1");
+    HostInit();
+
+    HOST_CHECK(HostRun(
+        "count = 0\n"
+        "function on_ad(self, msg)\n"
+        "    count = count + 1\n"
+        "    if msg.message == admob.MESSAGE_LOADED then loaded = true\n"
+        "    elseif msg.message == admob.MESSAGE_UNLOADED then unloaded = true\n"
+        "    elseif msg.message == admob.MESSAGE_FAILED_TO_LOAD then error('failed to load: ' .. msg.result_string) end\n"
+        "end\n"
+        "admob.set_ready_callback(function(self, msg) ready = true end)"));
+    HOST_CHECK(HostUpdateUntil("ready", TEST_TIMEOUT));
+
+    TestIdleUpdate();
+    TestEvents();
+    TestLoadUnload();
+
+    HostFinalize();
+    printf("alloc_test: ok\n");
+    return 0;
+}
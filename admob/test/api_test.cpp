@@ -0,0 +1,124 @@
+// Tests of the Lua API on the fake backend
+// Usage: api_test
+
+#include "../src/googlemobileads.cpp"
+
+#include "host.h"
+
+using namespace AdMobTest;
+
+static const uint64_t TEST_TIMEOUT = 10000000; // 10s
+static const char* TEST_JOURNAL_PATH = "build/api_test_journal.bin";
+
+static const char* API_LUA =
+    "messages = {}\n"
+    "function callback(name)\n"
+    "    messages[name] = {}\n"
+    "    return function(self, msg)\n"
+    "        table.insert(messages[name], msg.message)\n"
+    "        if msg.message == admob.MESSAGE_LOADED then _G[name .. '_loaded'] = true end\n"
+    "        if msg.message == admob.MESSAGE_UNLOADED then _G[name .. '_unloaded'] = true end\n"
+    "        if msg.message == admob.MESSAGE_LAYOUT then _G[name .. '_layout'] = true end\n"
+    "    end\n"
+    "end\n"
+    "function received(name, message)\n"
+    "    for _, m in ipairs(messages[name] or {}) do\n"
+    "        if m == message then return true end\n"
+    "    end\n"
+    "    return false\n"
+    "end\n"
+    "replayed = {}\n"
+    "function replay_callback(self, msg)\n"
+    "    if msg.message ~= admob.MESSAGE_READY then table.insert(replayed, msg) end\n"
+    "end\n"
+    // The replayed messages of an ad type must be the ones its callback received, in order
+    "function check_replayed(name, type, ad_unit)\n"
+    "    local i = 1\n"
+    "    for _, msg in ipairs(replayed) do\n"
+    "        if msg.type == type then\n"
+    "            assert(msg.ad_unit == ad_unit)\n"
+    "            assert(msg.message == messages[name][i])\n"
+    "            if msg.message == admob.MESSAGE_LAYOUT then assert(msg.width > 0 and msg.height > 0) end\n"
+    "            i = i + 1\n"
+    "        end\n"
+    "    end\n"
+    "    assert(i == #messages[name] + 1)\n"
+    "end\n";
+
+// The messages recorded in the journal are delivered again by replay_journal(), with their type, ad unit and layout
+static void TestJournal()
+{
+    HOST_CHECK(HostRun("admob.load_banner('journal_bunit', {}, callback('journal_banner'))"));
+    HOST_CHECK(HostRun("admob.load_interstitial('journal_iunit', {}, callback('journal_interstitial'))"));
+    HOST_CHECK(HostUpdateUntil("journal_banner_loaded", TEST_TIMEOUT));
+    HOST_CHECK(HostUpdateUntil("journal_interstitial_loaded", TEST_TIMEOUT));
+    HOST_CHECK(HostRun("admob.move_banner(10, 20)"));
+    HOST_CHECK(HostUpdateUntil("journal_banner_layout", TEST_TIMEOUT));
+    HOST_CHECK(HostRun("admob.unload_banner(); admob.unload_interstitial()"));
+    HOST_CHECK(HostUpdateUntil("journal_banner_unloaded", TEST_TIMEOUT));
+    HOST_CHECK(HostUpdateUntil("journal_interstitial_unloaded", TEST_TIMEOUT));
+
+    char lua[256];
+    snprintf(lua, sizeof(lua), "assert(admob.save_journal('%s'))", TEST_JOURNAL_PATH);
+    HOST_CHECK(HostRun(lua));
+    snprintf(lua, sizeof(lua), "replay_count = admob.replay_journal('%s', replay_callback)", TEST_JOURNAL_PATH);
+    HOST_CHECK(HostRun(lua));
+    HOST_CHECK(HostRun("assert(#replayed == #messages.journal_banner + #messages.journal_interstitial)"));
+    HOST_CHECK(HostRun("assert(replay_count >= #replayed)"));
+    HOST_CHECK(HostRun("check_replayed('journal_banner', admob.TYPE_BANNER, 'journal_bunit')"));
+    HOST_CHECK(HostRun("check_replayed('journal_interstitial', admob.TYPE_INTERSTITIAL, 'journal_iunit')"));
+    remove(TEST_JOURNAL_PATH);
+    printf("journal: %d messages replayed: ok\n", (int)HostGetNumber("replay_count"));
+}
+
+// A load with bad arguments must fail without touching the ad, so the next load (or unload) of the type works
+static void TestLoadArguments()
+{
+    HOST_CHECK(HostRun("admob.load_banner('bunit', {}, callback('banner'))"));
+    HOST_CHECK(HostUpdateUntil("banner_loaded", TEST_TIMEOUT));
+
+    HOST_CHECK(HostRun("assert(not pcall(admob.load_interstitial, 'iunit', {}))")); // No callback
+    HOST_CHECK(HostRun("assert(not pcall(admob.load_interstitial, 'iunit', { keywords = { 'a', {} } }, callback('interstitial')))"));
+    HOST_CHECK(HostRun("assert(not pcall(admob.load_interstitial, 'iunit', { keywords = { 'a' }, extras = { k = {} } }, callback('interstitial')))"));
+    HOST_CHECK(HostRun("assert(not pcall(admob.load_nativeexpress, 'nunit', { width = 'wide' }, callback('nativeexpress')))"));
+    HOST_CHECK(HostRun("assert(not pcall(admob.unload_interstitial))"));
+    HostUpdate(10);
+
+    HOST_CHECK(HostRun("admob.load_interstitial('iunit', { keywords = { 'a' } }, callback('interstitial'))"));
+    HOST_CHECK(HostRun("admob.load_nativeexpress('nunit', { width = 300 }, callback('nativeexpress'))"));
+    HOST_CHECK(HostUpdateUntil("interstitial_loaded", TEST_TIMEOUT));
+    HOST_CHECK(HostUpdateUntil("nativeexpress_loaded", TEST_TIMEOUT));
+
+    // The unload goes to the interstitial, and the banner is still loaded
+    HOST_CHECK(HostRun("admob.unload_interstitial()"));
+    HOST_CHECK(HostUpdateUntil("interstitial_unloaded", TEST_TIMEOUT));
+    HOST_CHECK(HostRun("assert(not received('banner', admob.MESSAGE_UNLOADED))"));
+    HOST_CHECK(g_AdMob->m_Ads[AdMobExtension::ADMOB_TYPE_BANNER].m_Initialized);
+
+    HOST_CHECK(HostRun("admob.unload_banner(); admob.unload_nativeexpress()"));
+    HOST_CHECK(HostUpdateUntil("banner_unloaded", TEST_TIMEOUT));
+    HOST_CHECK(HostUpdateUntil("nativeexpress_unloaded", TEST_TIMEOUT));
+    printf("load arguments: ok\n");
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc; (void)argv;
+    HostSetConfig("admob.fake_fill_rate", "1");
+    HostSetConfig("admob.fake_latency_min", "0");
+    HostSetConfig("admob.fake_latency_max", "1");
+    HostSetConfig("admob.fake_latency_tail_rate", "0");
+    HostSetConfig("admob.journal_size", "256");
+    HostInit();
+
+    HOST_CHECK(HostRun(API_LUA));
+    HOST_CHECK(HostRun("admob.set_ready_callback(function(self, msg) ready = true end)"));
+    HOST_CHECK(HostUpdateUntil("ready", TEST_TIMEOUT));
+
+    TestJournal(); // First, so that the journal only holds its messages
+    TestLoadArguments();
+
+    HostFinalize();
+    printf("api_test: ok\n");
+    return 0;
+}
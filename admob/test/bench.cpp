@@ -0,0 +1,199 @@
+// A benchmark of the hot paths of the extension, on the fake backend (with zero latency)
+// Usage: bench [output.json]
+// The results are written as JSON, so that a build server can track them over time.
+
+// Built as one unit with the extension, to reach its internal functions
+#include "../src/googlemobileads.cpp"
+
+#include "host.h"
+
+using namespace AdMobTest;
+
+static const uint64_t BENCH_TIMEOUT = 10000000; // 10s
+
+static double Seconds(uint64_t start)
+{
+    return (dmTime::GetTime() - start) / 1000000.0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// QueueCommand from N producer threads, while the main thread updates
+
+struct BenchProducer
+{
+    dmThread::Thread    m_Thread;
+    uint32_t            m_Count;
+    int32_atomic_t*     m_Running;
+};
+
+static void ProducerThread(void* ctx)
+{
+    BenchProducer* producer = (BenchProducer*)ctx;
+    for( uint32_t i = 0; i < producer->m_Count; ++i )
+    {
+        // The banner has no callback, so only the queue itself is measured
+        AdMobExtension::QueueCommand(AdMobExtension::ADMOB_TYPE_BANNER, AdMobExtension::ADMOB_MESSAGE_HIDE, 0, 0, 0);
+    }
+    dmAtomicAdd32(producer->m_Running, -1);
+}
+
+static bool IsQueueEmpty()
+{
+    DM_MUTEX_SCOPED_LOCK(g_AdMob->m_CmdQueueMutex);
+    return g_AdMob->m_CmdQueue.Empty();
+}
+
+static void BenchQueueCommand(FILE* out, uint32_t num_threads, uint32_t count)
+{
+    BenchProducer producers[8];
+    int32_atomic_t running = (int32_t)num_threads;
+    uint64_t start = dmTime::GetTime();
+    for( uint32_t i = 0; i < num_threads; ++i )
+    {
+        producers[i].m_Count = count;
+        producers[i].m_Running = &running;
+        producers[i].m_Thread = dmThread::New(ProducerThread, 0x10000, &producers[i], "bench_producer");
+    }
+    uint32_t frames = 0;
+    while( dmAtomicGet32(&running) != 0 || !IsQueueEmpty() )
+    {
+        HostUpdate(1);
+        ++frames;
+    }
+    double seconds = Seconds(start);
+    for( uint32_t i = 0; i < num_threads; ++i )
+        dmThread::Join(producers[i].m_Thread);
+
+    uint32_t total = num_threads * count;
+    fprintf(out, "    { \"threads\": %u, \"commands\": %u, \"frames\": %u, \"seconds\": %.6f, \"commands_per_second\": %.0f }",
+                    num_threads, total, frames, seconds, total / seconds);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// FlushCommandQueue + InvokeCallback, per event delivered to a Lua callback
+
+static void BenchFlush(FILE* out, uint32_t batch, uint32_t frames)
+{
+    HOST_CHECK(HostRun("loaded = false; admob.load_interstitial('bench', {}, on_ad)"));
+    HOST_CHECK(HostUpdateUntil("loaded", BENCH_TIMEOUT));
+    HOST_CHECK(HostRun("count = 0"));
+
+    uint64_t elapsed = 0;
+    for( uint32_t f = 0; f < frames; ++f )
+    {
+        for( uint32_t i = 0; i < batch; ++i )
+            AdMobExtension::QueueCommand(AdMobExtension::ADMOB_TYPE_INTERSTITIAL, AdMobExtension::ADMOB_MESSAGE_REWARD, 0, 0, 0);
+        uint64_t start = dmTime::GetTime();
+        HostUpdate(1);
+        elapsed += dmTime::GetTime() - start;
+    }
+    uint32_t events = (uint32_t)HostGetNumber("count");
+    HOST_CHECK(events == batch * frames);
+
+    HOST_CHECK(HostRun("unloaded = false; admob.unload_interstitial()"));
+    HOST_CHECK(HostUpdateUntil("unloaded", BENCH_TIMEOUT));
+
+    fprintf(out, "  \"flush_invoke_callback\": { \"events\": %u, \"events_per_frame\": %u, \"ns_per_event\": %.1f },\n",
+                    events, batch, elapsed * 1000.0 / events);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SetupAdRequest + DeleteAdRequest, with a number of keywords and extras
+
+static void BenchSetupAdRequest(FILE* out, lua_State* L, uint32_t num_strings, uint32_t iterations)
+{
+    char lua[256];
+    snprintf(lua, sizeof(lua), "request = { keywords = {}, extras = {}, gender = admob.GENDER_FEMALE }\n"
+                               "for i = 1, %u do request.keywords[i] = 'keyword' .. i; request.extras['key' .. i] = 'value' .. i end", num_strings);
+    HOST_CHECK(HostRun(lua));
+
+    lua_getglobal(L, "request");
+    int index = lua_gettop(L);
+    uint64_t start = dmTime::GetTime();
+    for( uint32_t i = 0; i < iterations; ++i )
+    {
+        firebase::admob::AdRequest request;
+        SetupAdRequest(L, index, request);
+        DeleteAdRequest(request);
+    }
+    double seconds = Seconds(start);
+    lua_pop(L, 1);
+
+    fprintf(out, "    { \"keywords\": %u, \"extras\": %u, \"ns_per_request\": %.1f }", num_strings, num_strings, seconds * 1e9 / iterations);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Load -> loaded -> show -> hidden -> unload -> unloaded, of an interstitial
+
+static void BenchLifecycles(FILE* out, uint32_t count)
+{
+    uint64_t start = dmTime::GetTime();
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        HOST_CHECK(HostRun("loaded = false; hidden = false; unloaded = false; admob.load_interstitial('bench', {}, on_ad)"));
+        HOST_CHECK(HostUpdateUntil("loaded", BENCH_TIMEOUT));
+        HOST_CHECK(HostRun("admob.show_interstitial()"));
+        HOST_CHECK(HostUpdateUntil("hidden", BENCH_TIMEOUT));
+        HOST_CHECK(HostRun("admob.unload_interstitial()"));
+        HOST_CHECK(HostUpdateUntil("unloaded", BENCH_TIMEOUT));
+    }
+    double seconds = Seconds(start);
+    fprintf(out, "  \"lifecycles\": { \"count\": %u, \"seconds\": %.6f, \"per_second\": %.1f }\n", count, seconds, count / seconds);
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = argc > 1 ? argv[1] : "bench.json";
+
+    HostSetConfig("admob.fake_fill_rate", "1");
+    HostSetConfig("admob.fake_latency_min", "0");
+    HostSetConfig("admob.fake_latency_max", "0");
+    HostSetConfig("admob.fake_latency_tail_rate", "0");
+    HostSetConfig("admob.fake_show_duration", "0");
+    lua_State* L = HostInit();
+
+    HOST_CHECK(HostRun(
+        "count = 0\n"
+        "function on_ad(self, msg)\n"
+        "    count = count + 1\n"
+        "    if msg.message == admob.MESSAGE_LOADED then loaded = true\n"
+        "    elseif msg.message == admob.MESSAGE_HIDE then hidden = true\n"
+        "    elseif msg.message == admob.MESSAGE_UNLOADED then unloaded = true\n"
+        "    elseif msg.message == admob.MESSAGE_FAILED_TO_LOAD then error('failed to load: ' .. msg.result_string) end\n"
+        "end\n"
+        "admob.set_ready_callback(function(self, msg) ready = true end)"));
+    HOST_CHECK(HostUpdateUntil("ready", BENCH_TIMEOUT));
+
+    FILE* out = fopen(path, "wb");
+    HOST_CHECK(out != 0);
+    fprintf(out, "{\n");
+
+    fprintf(out, "  \"queue_command\": [\n");
+    const uint32_t threads[] = { 1, 2, 4, 8 };
+    for( uint32_t i = 0; i < sizeof(threads)/sizeof(threads[0]); ++i )
+    {
+        BenchQueueCommand(out, threads[i], 200000);
+        fprintf(out, "%s\n", i + 1 < sizeof(threads)/sizeof(threads[0]) ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+
+    BenchFlush(out, 1000, 200);
+
+    fprintf(out, "  \"setup_ad_request\": [\n");
+    const uint32_t strings[] = { 0, 1, 4, 16, 64 };
+    for( uint32_t i = 0; i < sizeof(strings)/sizeof(strings[0]); ++i )
+    {
+        BenchSetupAdRequest(out, L, strings[i], 20000);
+        fprintf(out, "%s\n", i + 1 < sizeof(strings)/sizeof(strings[0]) ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+
+    BenchLifecycles(out, 500);
+
+    fprintf(out, "}\n");
+    fclose(out);
+
+    HostFinalize();
+    printf("Wrote %s\n", path);
+    return 0;
+}
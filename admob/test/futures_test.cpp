@@ -0,0 +1,259 @@
+// Tests of the future continuations (futures.h), over sdk futures that the test completes itself
+// Usage: futures_test
+
+#include "../src/googlemobileads.cpp"
+
+#include "host.h"
+
+using namespace AdMobTest;
+
+static const uint32_t TEST_POOL_SIZE = 32;
+static const uint32_t TEST_MAX_FUTURES = 1024;
+
+// The sdk futures of the test. They complete on the calling thread, when the test says so
+class TestFutureApi : public firebase::detail::FutureApiInterface
+{
+public:
+    TestFutureApi() : m_Count(0) { memset(m_Futures, 0, sizeof(m_Futures)); }
+
+    // Returns the handle of a new, pending future
+    firebase::FutureHandle New()
+    {
+        HOST_CHECK(m_Count < TEST_MAX_FUTURES);
+        m_Futures[m_Count].m_Status = firebase::kFutureStatusPending;
+        return ++m_Count;
+    }
+
+    firebase::Future<void> GetFuture(firebase::FutureHandle handle)
+    {
+        return firebase::Future<void>(this, handle);
+    }
+
+    void Complete(firebase::FutureHandle handle, int error)
+    {
+        TestFuture* f = Get(handle);
+        HOST_CHECK(f->m_Status == firebase::kFutureStatusPending);
+        f->m_Status = firebase::kFutureStatusComplete;
+        f->m_Error = error;
+        if( f->m_Callback )
+            f->m_Callback(GetFuture(handle), f->m_UserData);
+    }
+
+    virtual void ReferenceFuture(firebase::FutureHandle handle) { (void)handle; }
+    virtual void ReleaseFuture(firebase::FutureHandle handle) { (void)handle; }
+    virtual firebase::FutureStatus GetFutureStatus(firebase::FutureHandle handle) const { return Get(handle)->m_Status; }
+    virtual int GetFutureError(firebase::FutureHandle handle) const { return Get(handle)->m_Error; }
+    virtual const char* GetFutureErrorMessage(firebase::FutureHandle handle) const { return Get(handle)->m_Error ? "test error" : ""; }
+    virtual const void* GetFutureResult(firebase::FutureHandle handle) const { (void)handle; return 0; }
+
+    virtual void SetCompletionCallback(firebase::FutureHandle handle, firebase::FutureBase::CompletionCallback callback, void* user_data)
+    {
+        TestFuture* f = Get(handle);
+        f->m_Callback = callback;
+        f->m_UserData = user_data;
+        if( f->m_Status == firebase::kFutureStatusComplete )
+            callback(firebase::Future<void>(this, handle), user_data);
+    }
+
+private:
+    struct TestFuture
+    {
+        firebase::FutureBase::CompletionCallback    m_Callback;
+        void*                                       m_UserData;
+        int                                         m_Error;
+        firebase::FutureStatus                      m_Status;
+    };
+
+    TestFuture* Get(firebase::FutureHandle handle) const
+    {
+        HOST_CHECK(handle > 0 && handle <= m_Count);
+        return (TestFuture*)&m_Futures[handle - 1];
+    }
+
+    TestFuture  m_Futures[TEST_MAX_FUTURES];
+    uint32_t    m_Count;
+};
+
+static TestFutureApi g_Api;
+
+struct TestResult
+{
+    int m_Count;
+    int m_Error;
+};
+
+static void OnTestCompletion(int error, const char* error_message, void* user_data)
+{
+    (void)error_message;
+    TestResult* result = (TestResult*)user_data;
+    result->m_Count++;
+    result->m_Error = error;
+}
+
+struct TestStep
+{
+    firebase::FutureHandle  m_Future;   // Returned by the step
+    int                     m_Count;
+};
+
+static firebase::FutureBase TestStepFn(void* user_data)
+{
+    TestStep* step = (TestStep*)user_data;
+    step->m_Count++;
+    return g_Api.GetFuture(step->m_Future);
+}
+
+static void TestThen()
+{
+    // The step is called once the first future succeeds, and the chain completes with the future it returns
+    firebase::FutureHandle first = g_Api.New();
+    TestStep step = { g_Api.New(), 0 };
+    TestResult result = { 0, -1 };
+    AdMobExtension::FutureOnCompletion(AdMobExtension::FutureThen(AdMobExtension::FutureFrom(g_Api.GetFuture(first)), TestStepFn, &step), OnTestCompletion, &result);
+    HOST_CHECK(step.m_Count == 0);
+    g_Api.Complete(first, 0);
+    HOST_CHECK(step.m_Count == 1 && result.m_Count == 0);
+    g_Api.Complete(step.m_Future, 0);
+    HOST_CHECK(result.m_Count == 1 && result.m_Error == 0);
+
+    // An error skips the step
+    first = g_Api.New();
+    step.m_Count = 0;
+    result.m_Count = 0;
+    AdMobExtension::FutureOnCompletion(AdMobExtension::FutureThen(AdMobExtension::FutureFrom(g_Api.GetFuture(first)), TestStepFn, &step), OnTestCompletion, &result);
+    g_Api.Complete(first, AdMobExtension::ADMOB_ERROR_NOFILL);
+    HOST_CHECK(step.m_Count == 0 && result.m_Count == 1 && result.m_Error == AdMobExtension::ADMOB_ERROR_NOFILL);
+
+    // A future that is already complete is passed on at once
+    first = g_Api.New();
+    g_Api.Complete(first, 0);
+    result.m_Count = 0;
+    AdMobExtension::FutureOnCompletion(AdMobExtension::FutureFrom(g_Api.GetFuture(first)), OnTestCompletion, &result);
+    HOST_CHECK(result.m_Count == 1 && result.m_Error == 0);
+    printf("then: ok\n");
+}
+
+static void TestWhenAll()
+{
+    firebase::FutureHandle futures[3] = { g_Api.New(), g_Api.New(), g_Api.New() };
+    AdMobExtension::HFuture handles[3];
+    for( uint32_t i = 0; i < 3; ++i )
+        handles[i] = AdMobExtension::FutureFrom(g_Api.GetFuture(futures[i]));
+    TestResult result = { 0, -1 };
+    AdMobExtension::FutureOnCompletion(AdMobExtension::FutureWhenAll(handles, 3), OnTestCompletion, &result);
+    g_Api.Complete(futures[2], 0);
+    g_Api.Complete(futures[0], 0);
+    HOST_CHECK(result.m_Count == 0);
+    g_Api.Complete(futures[1], 0);
+    HOST_CHECK(result.m_Count == 1 && result.m_Error == 0);
+
+    // The first error completes it, and the late inputs are dropped
+    for( uint32_t i = 0; i < 3; ++i )
+    {
+        futures[i] = g_Api.New();
+        handles[i] = AdMobExtension::FutureFrom(g_Api.GetFuture(futures[i]));
+    }
+    result.m_Count = 0;
+    AdMobExtension::FutureOnCompletion(AdMobExtension::FutureWhenAll(handles, 3), OnTestCompletion, &result);
+    g_Api.Complete(futures[1], AdMobExtension::ADMOB_ERROR_NETWORKERROR);
+    HOST_CHECK(result.m_Count == 1 && result.m_Error == AdMobExtension::ADMOB_ERROR_NETWORKERROR);
+    g_Api.Complete(futures[0], 0);
+    g_Api.Complete(futures[2], AdMobExtension::ADMOB_ERROR_NOFILL);
+    HOST_CHECK(result.m_Count == 1);
+    printf("when all: ok\n");
+}
+
+static void TestWhenAny()
+{
+    firebase::FutureHandle futures[3] = { g_Api.New(), g_Api.New(), g_Api.New() };
+    AdMobExtension::HFuture handles[3];
+    for( uint32_t i = 0; i < 3; ++i )
+        handles[i] = AdMobExtension::FutureFrom(g_Api.GetFuture(futures[i]));
+    TestResult result = { 0, -1 };
+    AdMobExtension::FutureOnCompletion(AdMobExtension::FutureWhenAny(handles, 3), OnTestCompletion, &result);
+    g_Api.Complete(futures[0], AdMobExtension::ADMOB_ERROR_NOFILL);
+    HOST_CHECK(result.m_Count == 0);
+    g_Api.Complete(futures[2], 0);
+    HOST_CHECK(result.m_Count == 1 && result.m_Error == 0);
+    g_Api.Complete(futures[1], 0);
+    HOST_CHECK(result.m_Count == 1);
+
+    // Fails with the last error if none succeeds
+    for( uint32_t i = 0; i < 3; ++i )
+    {
+        futures[i] = g_Api.New();
+        handles[i] = AdMobExtension::FutureFrom(g_Api.GetFuture(futures[i]));
+    }
+    result.m_Count = 0;
+    AdMobExtension::FutureOnCompletion(AdMobExtension::FutureWhenAny(handles, 3), OnTestCompletion, &result);
+    g_Api.Complete(futures[0], AdMobExtension::ADMOB_ERROR_NOFILL);
+    g_Api.Complete(futures[1], AdMobExtension::ADMOB_ERROR_NOFILL);
+    HOST_CHECK(result.m_Count == 0);
+    g_Api.Complete(futures[2], AdMobExtension::ADMOB_ERROR_NETWORKERROR);
+    HOST_CHECK(result.m_Count == 1 && result.m_Error == AdMobExtension::ADMOB_ERROR_NETWORKERROR);
+    printf("when any: ok\n");
+}
+
+static void TestTimeout()
+{
+    firebase::FutureHandle future = g_Api.New();
+    TestResult result = { 0, -1 };
+    AdMobExtension::FutureOnCompletion(AdMobExtension::FutureTimeout(AdMobExtension::FutureFrom(g_Api.GetFuture(future)), 1000), OnTestCompletion, &result);
+    AdMobExtension::FutureUpdate();
+    HOST_CHECK(result.m_Count == 0);
+    dmTime::Sleep(2000);
+    AdMobExtension::FutureUpdate();
+    HOST_CHECK(result.m_Count == 1 && result.m_Error == AdMobExtension::ADMOB_ERROR_TIMEOUT);
+    g_Api.Complete(future, 0); // Late
+    HOST_CHECK(result.m_Count == 1);
+
+    // In time
+    future = g_Api.New();
+    result.m_Count = 0;
+    AdMobExtension::FutureOnCompletion(AdMobExtension::FutureTimeout(AdMobExtension::FutureFrom(g_Api.GetFuture(future)), 1000000), OnTestCompletion, &result);
+    g_Api.Complete(future, 0);
+    HOST_CHECK(result.m_Count == 1 && result.m_Error == 0);
+    printf("timeout: ok\n");
+}
+
+// The futures that never complete must not hold on to their nodes once their consumer is done, or the pool runs out
+static void TestStuckFutures()
+{
+    TestResult result = { 0, -1 };
+    for( uint32_t i = 0; i < TEST_POOL_SIZE * 4; ++i )
+    {
+        // A timeout over a chain that is stuck in its second step
+        firebase::FutureHandle first = g_Api.New();
+        TestStep step = { g_Api.New(), 0 };
+        AdMobExtension::HFuture chain = AdMobExtension::FutureThen(AdMobExtension::FutureFrom(g_Api.GetFuture(first)), TestStepFn, &step);
+        AdMobExtension::FutureOnCompletion(AdMobExtension::FutureTimeout(chain, 0), OnTestCompletion, &result);
+        g_Api.Complete(first, 0);
+        AdMobExtension::FutureUpdate();
+        HOST_CHECK(result.m_Error == AdMobExtension::ADMOB_ERROR_TIMEOUT);
+
+        // An 'any' node with stuck losers
+        firebase::FutureHandle futures[2] = { g_Api.New(), g_Api.New() };
+        AdMobExtension::HFuture handles[2] = { AdMobExtension::FutureFrom(g_Api.GetFuture(futures[0])), AdMobExtension::FutureFrom(g_Api.GetFuture(futures[1])) };
+        AdMobExtension::FutureOnCompletion(AdMobExtension::FutureWhenAny(handles, 2), OnTestCompletion, &result);
+        g_Api.Complete(futures[1], 0);
+        HOST_CHECK(result.m_Error == 0);
+    }
+    HOST_CHECK(result.m_Count == (int)TEST_POOL_SIZE * 8);
+    printf("stuck futures: ok\n");
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc; (void)argv;
+    AdMobExtension::FutureInit(TEST_POOL_SIZE);
+
+    TestThen();
+    TestWhenAll();
+    TestWhenAny();
+    TestTimeout();
+    TestStuckFutures();
+
+    AdMobExtension::FutureFinalize();
+    printf("futures_test: ok\n");
+    return 0;
+}
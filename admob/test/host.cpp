@@ -0,0 +1,245 @@
+#include "host.h"
+
+#include <dmsdk/dlib/time.h>
+
+extern "C" void luaL_openlibs(lua_State* L);
+
+namespace AdMobTest {
+
+static const uint32_t HOST_MAX_CONFIG = 64;
+
+struct HostConfigValue
+{
+    const char* m_Key;
+    const char* m_Value;
+};
+
+struct HostExtension
+{
+    dmExtension::Result (*m_AppInitialize)(dmExtension::AppParams* params);
+    dmExtension::Result (*m_AppFinalize)(dmExtension::AppParams* params);
+    dmExtension::Result (*m_Initialize)(dmExtension::Params* params);
+    dmExtension::Result (*m_Finalize)(dmExtension::Params* params);
+    dmExtension::Result (*m_Update)(dmExtension::Params* params);
+    void                (*m_OnEvent)(dmExtension::Params* params, const dmExtension::Event* event);
+};
+
+struct Host
+{
+    HostConfigValue         m_Config[HOST_MAX_CONFIG];
+    uint32_t                m_NumConfig;
+    HostExtension           m_Extension;
+    dmExtension::AppParams  m_AppParams;
+    dmExtension::Params     m_Params;
+    lua_State*              m_L;
+};
+
+static Host g_Host;
+
+static const char* GetConfigValue(const char* key)
+{
+    for( uint32_t i = 0; i < g_Host.m_NumConfig; ++i )
+    {
+        if( strcmp(g_Host.m_Config[i].m_Key, key) == 0 )
+            return g_Host.m_Config[i].m_Value;
+    }
+    return 0;
+}
+
+void HostSetConfig(const char* key, const char* value)
+{
+    for( uint32_t i = 0; i < g_Host.m_NumConfig; ++i )
+    {
+        if( strcmp(g_Host.m_Config[i].m_Key, key) == 0 )
+        {
+            g_Host.m_Config[i].m_Value = value;
+            return;
+        }
+    }
+    HOST_CHECK(g_Host.m_NumConfig < HOST_MAX_CONFIG);
+    g_Host.m_Config[g_Host.m_NumConfig].m_Key = key;
+    g_Host.m_Config[g_Host.m_NumConfig].m_Value = value;
+    g_Host.m_NumConfig++;
+}
+
+lua_State* HostInit()
+{
+    HOST_CHECK(g_Host.m_Extension.m_AppInitialize != 0); // The extension registers itself at startup
+
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    g_Host.m_L = L;
+
+    g_Host.m_AppParams.m_ConfigFile = (dmConfigFile::HConfig)&g_Host;
+    g_Host.m_Params.m_ConfigFile = g_Host.m_AppParams.m_ConfigFile;
+    g_Host.m_Params.m_L = L;
+    HOST_CHECK(g_Host.m_Extension.m_AppInitialize(&g_Host.m_AppParams) == dmExtension::RESULT_OK);
+    HOST_CHECK(g_Host.m_Extension.m_Initialize(&g_Host.m_Params) == dmExtension::RESULT_OK);
+    return L;
+}
+
+void HostFinalize()
+{
+    g_Host.m_Extension.m_Finalize(&g_Host.m_Params);
+    g_Host.m_Extension.m_AppFinalize(&g_Host.m_AppParams);
+    lua_close(g_Host.m_L);
+    g_Host.m_L = 0;
+}
+
+void HostUpdate(uint32_t frames)
+{
+    for( uint32_t i = 0; i < frames; ++i )
+        g_Host.m_Extension.m_Update(&g_Host.m_Params);
+}
+
+static bool GetGlobalBool(const char* name)
+{
+    lua_getglobal(g_Host.m_L, name);
+    bool value = lua_toboolean(g_Host.m_L, -1) != 0;
+    lua_pop(g_Host.m_L, 1);
+    return value;
+}
+
+bool HostUpdateUntil(const char* name, uint64_t timeout)
+{
+    uint64_t end = dmTime::GetTime() + timeout;
+    while( !GetGlobalBool(name) )
+    {
+        if( dmTime::GetTime() > end )
+            return false;
+        HostUpdate(1);
+    }
+    return true;
+}
+
+void HostEvent(dmExtension::EventID id)
+{
+    dmExtension::Event event;
+    event.m_Event = id;
+    g_Host.m_Extension.m_OnEvent(&g_Host.m_Params, &event);
+}
+
+bool HostRun(const char* lua)
+{
+    lua_State* L = g_Host.m_L;
+    if( luaL_loadstring(L, lua) != 0 || lua_pcall(L, 0, 0, 0) != 0 )
+    {
+        fprintf(stderr, "Lua error: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return false;
+    }
+    return true;
+}
+
+double HostGetNumber(const char* name)
+{
+    lua_getglobal(g_Host.m_L, name);
+    double value = lua_tonumber(g_Host.m_L, -1);
+    lua_pop(g_Host.m_L, 1);
+    return value;
+}
+
+} // AdMobTest
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The engine functions used by the extension
+
+namespace dmConfigFile {
+
+const char* GetString(HConfig config, const char* key, const char* default_value)
+{
+    (void)config;
+    const char* value = AdMobTest::GetConfigValue(key);
+    return value ? value : default_value;
+}
+
+int32_t GetInt(HConfig config, const char* key, int32_t default_value)
+{
+    (void)config;
+    const char* value = AdMobTest::GetConfigValue(key);
+    return value ? (int32_t)strtol(value, 0, 10) : default_value;
+}
+
+float GetFloat(HConfig config, const char* key, float default_value)
+{
+    (void)config;
+    const char* value = AdMobTest::GetConfigValue(key);
+    return value ? (float)strtod(value, 0) : default_value;
+}
+
+} // dmConfigFile
+
+namespace dmScript {
+
+lua_State* GetMainThread(lua_State* L)
+{
+    (void)L;
+    return AdMobTest::g_Host.m_L;
+}
+
+int Ref(lua_State* L, int table)
+{
+    return luaL_ref(L, table);
+}
+
+void Unref(lua_State* L, int table, int reference)
+{
+    luaL_unref(L, table, reference);
+}
+
+// The "script instance" (self) is kept in the registry
+void GetInstance(lua_State* L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, "__admob_test_instance");
+}
+
+void SetInstance(lua_State* L)
+{
+    lua_setfield(L, LUA_REGISTRYINDEX, "__admob_test_instance");
+}
+
+bool IsInstanceValid(lua_State* L)
+{
+    (void)L;
+    return true;
+}
+
+// No vector types in the tests
+bool IsVector3(lua_State* L, int index)
+{
+    (void)L; (void)index;
+    return false;
+}
+
+Vectormath::Aos::Vector3* ToVector3(lua_State* L, int index)
+{
+    (void)L; (void)index;
+    return 0;
+}
+
+Vectormath::Aos::Vector3* CheckVector3(lua_State* L, int index)
+{
+    luaL_error(L, "argument #%d: no vector3 in the host tests", index);
+    return 0;
+}
+
+} // dmScript
+
+namespace dmExtension {
+
+void Register(struct Desc* desc, uint32_t desc_size, const char* name,
+              Result (*app_init)(AppParams*), Result (*app_finalize)(AppParams*),
+              Result (*initialize)(Params*), Result (*finalize)(Params*),
+              Result (*update)(Params*), void (*on_event)(Params*, const Event*))
+{
+    (void)desc; (void)desc_size; (void)name;
+    AdMobTest::HostExtension* extension = &AdMobTest::g_Host.m_Extension;
+    extension->m_AppInitialize = app_init;
+    extension->m_AppFinalize = app_finalize;
+    extension->m_Initialize = initialize;
+    extension->m_Finalize = finalize;
+    extension->m_Update = update;
+    extension->m_OnEvent = on_event;
+}
+
+} // dmExtension
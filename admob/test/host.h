@@ -0,0 +1,40 @@
+#pragma once
+
+// A minimal engine for the host tests: it provides the parts of the Defold engine that the extension calls
+// (dmScript, dmConfigFile, dmExtension), and runs the extension through its registered entry points.
+// The tests are built against the fake backend (see ../src/fake_backend.h).
+
+#include <dmsdk/sdk.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace AdMobTest {
+
+// game.project values, set before HostInit(). The values are kept as pointers (use literals)
+void HostSetConfig(const char* key, const char* value);
+
+// Creates the Lua state, and calls the app initialize and initialize functions of the extension
+lua_State* HostInit();
+
+// Calls the finalize functions of the extension, and closes the Lua state
+void HostFinalize();
+
+// Calls the update function 'frames' times (no sleep)
+void HostUpdate(uint32_t frames);
+
+// Calls the update function until the Lua global 'name' is true, or the timeout (microseconds) is reached
+bool HostUpdateUntil(const char* name, uint64_t timeout);
+
+void HostEvent(dmExtension::EventID event);
+
+// Runs a chunk of Lua code. Errors are printed, and returned as false
+bool HostRun(const char* lua);
+
+// Reads a global number
+double HostGetNumber(const char* name);
+
+// A test assertion, that isn't compiled out with NDEBUG
+#define HOST_CHECK(cond) \
+    do { if( !(cond) ) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while(0)
+
+}
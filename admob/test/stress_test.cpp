@@ -0,0 +1,222 @@
+// A stress test for ThreadSanitizer (make tsan): many threads call the listeners and QueueCommand,
+// and race for the covering ad, while the main thread updates, goes to the background and back,
+// and loads, shows and unloads real ads on the fake backend.
+// Usage: stress_test [frames]
+
+#include "../src/googlemobileads.cpp"
+
+#include "host.h"
+
+using namespace AdMobTest;
+
+static const uint64_t TEST_TIMEOUT = 30000000; // 30s
+static const uint32_t STRESS_THREADS = 8;
+
+// The events of the stress threads go to the native express ad, which isn't loaded (its callback is set directly)
+static const int STRESS_ID = AdMobExtension::ADMOB_TYPE_NATIVEEXPRESS;
+static const char* STRESS_LONG_MESSAGE = "a message that is too long to be stored in the command, so it is copied";
+
+struct StressThread
+{
+    dmThread::Thread    m_Thread;
+    uint32_t            m_Index;
+};
+
+static int32_atomic_t g_Stop = 0;
+static int32_atomic_t g_QueuedShows = 0;
+static int32_atomic_t g_QueuedHides = 0;
+static int32_atomic_t g_QueuedRewards = 0;
+static int32_atomic_t g_LayoutCalls = 0;
+
+static void StressThreadMain(void* ctx)
+{
+    StressThread* thread = (StressThread*)ctx;
+    AdMobExtension::NativeExpressAdViewListener view_listener(&g_AdMob->m_CoveringUIAd, &g_AdMob->m_Bounds[STRESS_ID], STRESS_ID);
+    AdMobExtension::RewardedVideoListener video_listener(&g_AdMob->m_CoveringUIAd, STRESS_ID);
+
+    for( uint32_t i = 0; !dmAtomicGet32(&g_Stop); ++i )
+    {
+        dmTime::Sleep(200); // Lets the main thread keep up
+        switch( (i + thread->m_Index) % 5 )
+        {
+        case 0:
+            {
+                // All the fields have the same value, so a torn read shows
+                firebase::admob::BoundingBox box;
+                box.x = box.y = box.width = box.height = (int)(thread->m_Index * 1000 + i % 100);
+                view_listener.OnBoundingBoxChanged(0, box);
+                dmAtomicIncrement32(&g_LayoutCalls);
+            }
+            break;
+        case 1:
+            view_listener.OnPresentationStateChanged(0, firebase::admob::NativeExpressAdView::kPresentationStateCoveringUI);
+            break;
+        case 2:
+            view_listener.OnPresentationStateChanged(0, firebase::admob::NativeExpressAdView::kPresentationStateHidden);
+            dmAtomicIncrement32(&g_QueuedHides);
+            break;
+        case 3:
+            {
+                firebase::admob::rewarded_video::RewardItem reward;
+                reward.amount = 1.0f;
+                reward.reward_type = "coins";
+                video_listener.OnRewarded(reward);
+                dmAtomicIncrement32(&g_QueuedRewards);
+            }
+            break;
+        case 4:
+            AdMobExtension::QueueCommand(STRESS_ID, AdMobExtension::ADMOB_MESSAGE_SHOW, 0, STRESS_LONG_MESSAGE, 0);
+            dmAtomicIncrement32(&g_QueuedShows);
+            break;
+        }
+    }
+}
+
+static const char* STRESS_LUA =
+    "leaves = 0\n"
+    "unloads = 0\n"
+    "torn = false\n"
+    "events = {}\n"
+    "function on_stress(self, msg)\n"
+    "    events[msg.message] = (events[msg.message] or 0) + 1\n"
+    "    if msg.message == admob.MESSAGE_APP_LEAVE then leaves = leaves + 1 end\n"
+    "    if msg.message == admob.MESSAGE_LAYOUT and not (msg.x == msg.y and msg.y == msg.width and msg.width == msg.height) then torn = true end\n"
+    "end\n"
+    "\n"
+    "-- Each ad type goes idle -> loading -> loaded -> shown -> unloading -> idle, and is sometimes unloaded while loading.\n"
+    "-- A view is destroyed after its MESSAGE_UNLOADED, and can't be loaded again until then: the load is retried\n"
+    "local types = { 'banner', 'interstitial', 'rewardedvideo' }\n"
+    "state = {}\n"
+    "function on_ad(name, msg)\n"
+    "    if msg.message == admob.MESSAGE_APP_LEAVE then leaves = leaves + 1 end\n"
+    "    if msg.message == admob.MESSAGE_LOADED and state[name] == 'loading' then state[name] = 'loaded'\n"
+    "    elseif msg.message == admob.MESSAGE_FAILED_TO_LOAD or msg.message == admob.MESSAGE_UNLOADED then state[name] = 'idle' end\n"
+    "    if msg.message == admob.MESSAGE_UNLOADED then unloads = unloads + 1 end\n"
+    "end\n"
+    "function step(frame, stopping)\n"
+    "    for i, name in ipairs(types) do\n"
+    "        local s = state[name] or 'idle'\n"
+    "        if s == 'idle' and not stopping then\n"
+    "            if pcall(admob['load_' .. name], 'stress', { keywords = { 'a', 'b' }, extras = { k = 'v' } }, function(self, msg) on_ad(name, msg) end) then\n"
+    "                state[name] = 'loading'\n"
+    "            end\n"
+    "        elseif s == 'loaded' then\n"
+    "            admob['show_' .. name]()\n"
+    "            state[name] = 'shown'\n"
+    "        elseif (s == 'shown' and (stopping or frame % 7 == i)) or (s == 'loading' and frame % 29 == i) then\n"
+    "            admob['unload_' .. name]()\n"
+    "            state[name] = 'unloading'\n"
+    "        end\n"
+    "    end\n"
+    "end\n"
+    "function all_idle()\n"
+    "    for i, name in ipairs(types) do\n"
+    "        if (state[name] or 'idle') ~= 'idle' then return false end\n"
+    "    end\n"
+    "    return true\n"
+    "end\n";
+
+static void Step(uint32_t frame, bool stopping)
+{
+    char lua[64];
+    snprintf(lua, sizeof(lua), "step(%u, %s)", frame, stopping ? "true" : "false");
+    HOST_CHECK(HostRun(lua));
+    HostUpdate(1);
+}
+
+static uint32_t GetEventCount(lua_State* L, int message)
+{
+    lua_getglobal(L, "events");
+    lua_rawgeti(L, -1, message);
+    uint32_t count = (uint32_t)lua_tonumber(L, -1);
+    lua_pop(L, 2);
+    return count;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t frames = argc > 1 ? (uint32_t)atoi(argv[1]) : 5000;
+
+    HostSetConfig("admob.fake_fill_rate", "0.8");
+    HostSetConfig("admob.fake_latency_min", "0");
+    HostSetConfig("admob.fake_latency_max", "2");
+    HostSetConfig("admob.fake_latency_tail_rate", "0");
+    HostSetConfig("admob.fake_show_duration", "5");
+    HostSetConfig("admob.fake_callback_threads", "4");
+    HostSetConfig("admob.worker_thread", "1");
+    HostSetConfig("admob.journal_size", "256");
+    HostSetConfig("admob.profile", "1");
+    lua_State* L = HostInit();
+
+    HOST_CHECK(HostRun(STRESS_LUA));
+    HOST_CHECK(HostRun("admob.set_ready_callback(function(self, msg) ready = true end)"));
+    HOST_CHECK(HostUpdateUntil("ready", TEST_TIMEOUT));
+
+    lua_getglobal(L, "on_stress");
+    RegisterCallback(L, lua_gettop(L), &g_AdMob->m_Ads[STRESS_ID].m_Callback);
+    lua_pop(L, 1);
+
+    StressThread threads[STRESS_THREADS];
+    for( uint32_t i = 0; i < STRESS_THREADS; ++i )
+    {
+        threads[i].m_Index = i;
+        threads[i].m_Thread = dmThread::New(StressThreadMain, 0x10000, &threads[i], "stress");
+    }
+
+    // Each activation starts a new covering episode, in which only one ad may win the covering ad
+    uint32_t episodes = 1;
+    uint32_t frame = 0;
+    while( frame < frames )
+    {
+        Step(frame++, false);
+        dmTime::Sleep(500);
+        if( frame % 50 == 0 )
+        {
+            HostEvent(dmExtension::EVENT_ID_DEACTIVATEAPP);
+            HostUpdate(1);
+            HostEvent(dmExtension::EVENT_ID_ACTIVATEAPP);
+            episodes++;
+        }
+    }
+    dmAtomicStore32(&g_Stop, 1);
+    for( uint32_t i = 0; i < STRESS_THREADS; ++i )
+        dmThread::Join(threads[i].m_Thread);
+
+    uint64_t end = dmTime::GetTime() + TEST_TIMEOUT;
+    do
+    {
+        HOST_CHECK(dmTime::GetTime() < end);
+        Step(frame++, true);
+        lua_getglobal(L, "all_idle");
+        lua_call(L, 0, 1);
+        bool idle = lua_toboolean(L, -1) != 0;
+        lua_pop(L, 1);
+        if( idle )
+            break;
+    } while( true );
+    HostUpdate(10);
+
+    uint32_t shows = GetEventCount(L, AdMobExtension::ADMOB_MESSAGE_SHOW);
+    uint32_t hides = GetEventCount(L, AdMobExtension::ADMOB_MESSAGE_HIDE);
+    uint32_t rewards = GetEventCount(L, AdMobExtension::ADMOB_MESSAGE_REWARD);
+    uint32_t layouts = GetEventCount(L, AdMobExtension::ADMOB_MESSAGE_LAYOUT);
+    uint32_t leaves = (uint32_t)HostGetNumber("leaves");
+    uint32_t unloads = (uint32_t)HostGetNumber("unloads");
+    printf("stress: %u frames, %u episodes, %u unloaded ads, %u shows, %u hides, %u rewards, %u layouts (%d calls), %u app leaves\n",
+                frame, episodes, unloads, shows, hides, rewards, layouts, dmAtomicGet32(&g_LayoutCalls), leaves);
+
+    HOST_CHECK(shows == (uint32_t)dmAtomicGet32(&g_QueuedShows));
+    HOST_CHECK(hides == (uint32_t)dmAtomicGet32(&g_QueuedHides));
+    HOST_CHECK(rewards == (uint32_t)dmAtomicGet32(&g_QueuedRewards));
+    HOST_CHECK(layouts > 0 && layouts <= (uint32_t)dmAtomicGet32(&g_LayoutCalls));
+    HOST_CHECK(leaves > 0 && leaves <= episodes);
+    HOST_CHECK(unloads > 0);
+    lua_getglobal(L, "torn");
+    HOST_CHECK(!lua_toboolean(L, -1));
+    lua_pop(L, 1);
+
+    UnregisterCallback(&g_AdMob->m_Ads[STRESS_ID].m_Callback);
+    HostFinalize();
+    printf("stress_test: ok\n");
+    return 0;
+}